@@ -0,0 +1,86 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include "QuadTree/Boid.h"
+#include <algorithm>
+
+// Pan/zoom view onto the [-1,1] world. zoom 1 shows the whole domain,
+// the view never leaves the domain so no wrapped images need drawing.
+struct Camera
+{
+    float x = 0.f;
+    float y = 0.f;
+    float zoom = 1.f;
+    int width = 900;
+    int height = 900;
+
+    float HalfExtent() const { return 1.f/zoom; }
+
+    void Clamp()
+    {
+        zoom = std::max(1.f, std::min(zoom, 4096.f));
+        float limit = 1.f - HalfExtent();
+        x = std::max(-limit, std::min(x, limit));
+        y = std::max(-limit, std::min(y, limit));
+    }
+
+    void Pan(float dx, float dy)
+    {
+        x += dx*HalfExtent();
+        y += dy*HalfExtent();
+        Clamp();
+    }
+
+    // Zooms by `factor` keeping the world point under (ndc_x, ndc_y) fixed
+    void ZoomAt(float factor, float ndc_x, float ndc_y)
+    {
+        float world_x = x + ndc_x*HalfExtent();
+        float world_y = y + ndc_y*HalfExtent();
+        zoom *= factor;
+        Clamp();
+        x = world_x - ndc_x*HalfExtent();
+        y = world_y - ndc_y*HalfExtent();
+        Clamp();
+    }
+
+    void Reset()
+    {
+        x = y = 0.f;
+        zoom = 1.f;
+    }
+};
+
+// Does [a0,a1] overlap [b0,b1] on a circle of circumference 2
+inline bool PeriodicOverlap(float a0, float a1, float b0, float b1)
+{
+    for(float image = -2.f; image <= 2.f; image += 2.f)
+        if(a0 + image <= b1 && b0 <= a1 + image) return true;
+    return false;
+}
+
+// Collects the leaves whose bounds intersect the view, grown by `margin` to
+// cover boids that moved since the tree was built. Leaf bounds live in the
+// flock's shifted tree space, so they are mapped back to world space first.
+template<typename Storage>
+void CullLeaves(const BasicFlock<Storage>& flock, const std::vector<point_bucket>& tree, const Camera& camera, float margin, std::vector<const point_bucket*>& visible)
+{
+    visible.clear();
+    float extent = camera.HalfExtent() + margin;
+    if(extent >= 1.f)
+    {
+        for(auto& leaf: tree)
+            visible.push_back(&leaf);
+        return;
+    }
+
+    for(auto& leaf: tree)
+    {
+        float leaf_x = leaf.x - flock.tree_shift[0];
+        float leaf_y = leaf.y - flock.tree_shift[1];
+        if(PeriodicOverlap(leaf_x - leaf.x_length/2, leaf_x + leaf.x_length/2, camera.x - extent, camera.x + extent) &&
+           PeriodicOverlap(leaf_y - leaf.y_length/2, leaf_y + leaf.y_length/2, camera.y - extent, camera.y + extent))
+            visible.push_back(&leaf);
+    }
+}
+
+#endif
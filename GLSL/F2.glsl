@@ -0,0 +1,13 @@
+#version 330 core
+in vec2 uv;
+out vec4 FragColor;
+uniform sampler2D density; // r: boid count, gb: summed velocity
+uniform float density_scale;
+void main()
+{
+vec3 cell = texture(density, uv).rgb;
+float intensity = 1.0 - exp(-cell.r*density_scale);
+vec2 heading = cell.r > 0.0 ? normalize(cell.gb + 1e-12) : vec2(0.0);
+vec3 boid = vec3(1.0f, 0.5f, 0.2f) + 0.15*vec3(heading.x, heading.y, -heading.x);
+FragColor = vec4(mix(vec3(0.2f, 0.3f, 0.2f), boid, intensity), 1.0);
+}
@@ -1,6 +1,7 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+uniform vec3 view; // camera x, y, zoom
 void main()
 {
-gl_Position = vec4(aPos.x, aPos.y, aPos.z, 1.0);
-}
\ No newline at end of file
+gl_Position = vec4((aPos.x - view.x)*view.z, (aPos.y - view.y)*view.z, aPos.z, 1.0);
+}
@@ -0,0 +1,137 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "QuadTree/Boid.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+// Lock-free single producer/single consumer triple buffer. The producer
+// always has a slot to write, the consumer always has a complete slot to read,
+// and the third slot holds the newest published frame between them.
+template<typename T>
+class TripleBuffer
+{
+public:
+    T& WriteBuffer() { return slots[back]; }
+    const T& ReadBuffer() const { return slots[front]; }
+
+    // Hands the write slot over as the newest frame
+    void Publish()
+    {
+        back = middle.exchange(static_cast<uint8_t>(back | fresh_bit), std::memory_order_acq_rel) & index_mask;
+    }
+
+    // Swaps in the newest frame if one arrived since the last call
+    bool Acquire()
+    {
+        if(!(middle.load(std::memory_order_acquire) & fresh_bit)) return false;
+        front = middle.exchange(static_cast<uint8_t>(front), std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+
+private:
+    static const uint8_t fresh_bit = 4;
+    static const uint8_t index_mask = 3;
+
+    T slots[3];
+    uint8_t back = 0;
+    uint8_t front = 1;
+    std::atomic<uint8_t> middle{2};
+};
+
+// Accumulator for a simulation rate set independently of the display. Steps
+// are scheduled every 1/steps_per_second, the caller sleeps until one is due
+// and then runs every step that is due, up to max_substeps before giving up
+// on catching up.
+class FixedTimestep
+{
+public:
+    typedef std::chrono::high_resolution_clock clock;
+
+    FixedTimestep(double steps_per_second, size_t max_substeps) :
+    step_duration(std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0/steps_per_second))),
+    max_substeps(max_substeps),
+    next_step(clock::now())
+    {};
+
+    // Sleeps until a step is due and returns the number of steps to run
+    size_t Wait()
+    {
+        std::this_thread::sleep_until(next_step);
+        clock::time_point now = clock::now();
+        size_t due = 1 + static_cast<size_t>((now - next_step)/step_duration);
+        if(due > max_substeps)
+        {
+            // Too far behind, drop the backlog instead of spiralling
+            due = max_substeps;
+            next_step = now - (due - 1)*step_duration;
+        }
+        last_step = next_step + (due - 1)*step_duration;
+        next_step = last_step + step_duration;
+        return due;
+    }
+
+    // Scheduled time of the newest step returned by Wait
+    clock::time_point LastStep() const { return last_step; }
+    float StepSeconds() const { return std::chrono::duration<float>(step_duration).count(); }
+
+private:
+    clock::duration step_duration;
+    size_t max_substeps;
+    clock::time_point next_step;
+    clock::time_point last_step;
+};
+
+// Everything the renderer needs from one completed simulation step
+struct FrameSnapshot
+{
+    Flock flock;
+    // Locations one step before flock, for interpolating between the two
+    std::vector<float> previous_location[Flock::dimension];
+    std::vector<point_bucket> tree;
+    size_t step = 0;
+    size_t substeps = 0;
+    float compute_ms = 0.f;
+    float step_seconds = 0.f;
+    std::chrono::high_resolution_clock::time_point scheduled;
+    std::chrono::high_resolution_clock::time_point published;
+
+    // How far the display has moved from the previous step to this one
+    float Alpha(std::chrono::high_resolution_clock::time_point now) const
+    {
+        if(step_seconds <= 0.f) return 1.f;
+        float alpha = std::chrono::duration<float>(now - scheduled).count()/step_seconds;
+        return alpha < 0.f ? 0.f : (alpha > 1.f ? 1.f : alpha);
+    }
+};
+
+// Read-only flock view blending the last two steps of a snapshot, drawn one
+// step behind the simulation so motion stays smooth at any display rate
+struct InterpolatedView
+{
+    const FrameSnapshot& snapshot;
+    float alpha;
+
+    size_t size() const { return snapshot.flock.size(); }
+
+    float GetLocation(size_t d, size_t i) const
+    {
+        float current = snapshot.flock.GetLocation(d, i);
+        if(snapshot.previous_location[d].size() <= i) return current;
+        float previous = snapshot.previous_location[d][i];
+        // Step across the wrap seam the short way
+        float delta = current - previous;
+        if(delta > 1.f) delta -= 2.f;
+        else if(delta < -1.f) delta += 2.f;
+        float val = previous + alpha*delta;
+        if(val > 1.f) val -= 2.f;
+        else if(val < -1.f) val += 2.f;
+        return val;
+    }
+
+    float GetVelocity(size_t d, size_t i) const { return snapshot.flock.GetVelocity(d, i); }
+};
+
+#endif
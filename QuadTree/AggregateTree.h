@@ -0,0 +1,254 @@
+#ifndef AGGREGATETREE_H
+#define AGGREGATETREE_H
+
+#include "Boid.h"
+#include <algorithm>
+#include <cstdint>
+
+// Full quadtree (every level kept, unlike base_split's leaves) where each node
+// carries the count, location sum and velocity sum of the boids under it.
+// Cohesion and alignment only need those sums, so a node lying entirely
+// inside a boid's interaction radius can stand in for all of its members.
+//
+// Nodes are built in the flock's shifted tree space, which is the same torus
+// as world space, so offsets taken there are the world offsets.
+class AggregateTree
+{
+public:
+    struct Node
+    {
+        float x, y, half;       // Center and half side
+        uint32_t begin, end;    // Members are order[begin, end)
+        int32_t first_child;    // Four consecutive children, -1 for leaves
+        float count;
+        float location_sum[2];  // In tree space
+        float velocity_sum[2];
+    };
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> order;
+
+    // Barnes-Hut opening criterion. A node inside the radius is used as an
+    // aggregate only while its side/distance to its centre of mass is below
+    // theta; 0 opens everything (exact), larger trades separation accuracy
+    // for speed. Cohesion and alignment sums are exact for any theta.
+    float theta = 0.5f;
+
+    template<typename Storage>
+    void Build(const BasicFlock<Storage>& flock, size_t max_size = 16, size_t max_depth = 20)
+    {
+        size_t count = flock.size();
+        tree_location[0].resize(count);
+        tree_location[1].resize(count);
+        order.resize(count);
+        for(size_t i = 0; i < count; i++)
+        {
+            tree_location[0][i] = flock.TreeLocation(0, i);
+            tree_location[1][i] = flock.TreeLocation(1, i);
+            order[i] = static_cast<uint32_t>(i);
+        }
+        velocity[0].resize(count);
+        velocity[1].resize(count);
+        for(size_t i = 0; i < count; i++)
+        {
+            velocity[0][i] = flock.GetVelocity(0, i);
+            velocity[1][i] = flock.GetVelocity(1, i);
+        }
+
+        nodes.clear();
+        nodes.push_back(Node{0.f, 0.f, 1.f, 0, static_cast<uint32_t>(count), -1, 0.f, {0.f, 0.f}, {0.f, 0.f}});
+        Split(0, max_size, max_depth);
+    }
+
+    // Accumulates the flocking rules for every boid through the tree. Node
+    // aggregates only stand in for the built in rules; a flock with other
+    // rules gets every boid of the leaves in range passed to its own Update,
+    // which is exact whatever theta is.
+    template<typename FlockType>
+    void Update(FlockType& flock) const
+    {
+        ParallelFor(0, flock.size(), [&](size_t begin, size_t end)
+        {
+            std::vector<uint32_t> stack, candidates;
+            for(size_t i = begin; i < end; i++)
+            {
+                if constexpr(FlockType::builtin_rules) UpdateBoid(flock, i, stack);
+                else UpdateCandidates(flock, i, stack, candidates);
+            }
+        });
+    }
+
+private:
+    std::vector<float> tree_location[2];
+    std::vector<float> velocity[2];
+
+    // Partitions the node's members into quadrants, then sums bottom up
+    void Split(size_t index, size_t max_size, size_t depth)
+    {
+        Node node = nodes[index];
+        if(node.end - node.begin > max_size && depth > 0)
+        {
+            auto first = order.begin() + node.begin, last = order.begin() + node.end;
+            auto below = [&](uint32_t i) { return tree_location[1][i] < node.y; };
+            auto south_end = std::partition(first, last, below);
+            auto west = [&](uint32_t i) { return tree_location[0][i] < node.x; };
+            auto south_west_end = std::partition(first, south_end, west);
+            auto north_west_end = std::partition(south_end, last, west);
+
+            uint32_t bounds[5] = {node.begin, static_cast<uint32_t>(south_west_end - order.begin()),
+                static_cast<uint32_t>(south_end - order.begin()), static_cast<uint32_t>(north_west_end - order.begin()), node.end};
+            float quarter = node.half/2;
+            float centers[4][2] = {{node.x - quarter, node.y - quarter}, {node.x + quarter, node.y - quarter},
+                {node.x - quarter, node.y + quarter}, {node.x + quarter, node.y + quarter}};
+
+            int32_t first_child = static_cast<int32_t>(nodes.size());
+            nodes[index].first_child = first_child;
+            for(size_t c = 0; c < 4; c++)
+                nodes.push_back(Node{centers[c][0], centers[c][1], quarter, bounds[c], bounds[c + 1], -1, 0.f, {0.f, 0.f}, {0.f, 0.f}});
+
+            // Children grow the node array, so only index into it afterwards
+            for(size_t c = 0; c < 4; c++)
+                Split(first_child + c, max_size, depth - 1);
+            for(size_t c = 0; c < 4; c++)
+            {
+                const Node& child = nodes[first_child + c];
+                Node& parent = nodes[index];
+                parent.count += child.count;
+                for(size_t d = 0; d < 2; d++)
+                {
+                    parent.location_sum[d] += child.location_sum[d];
+                    parent.velocity_sum[d] += child.velocity_sum[d];
+                }
+            }
+            return;
+        }
+
+        Node& leaf = nodes[index];
+        leaf.count = static_cast<float>(node.end - node.begin);
+        for(uint32_t m = node.begin; m < node.end; m++)
+            for(size_t d = 0; d < 2; d++)
+            {
+                leaf.location_sum[d] += tree_location[d][order[m]];
+                leaf.velocity_sum[d] += velocity[d][order[m]];
+            }
+    }
+
+    // Whether a node's box comes within radius of p, in tree space
+    bool InRange(const Node& node, const float (&p)[2], float radius_squared, bool periodic) const
+    {
+        float dx = p[0] - node.x, dy = p[1] - node.y;
+        if(periodic)
+        {
+            dx = MinimumImage(dx);
+            dy = MinimumImage(dy);
+        }
+        float near_x = std::max(0.f, fabsf(dx) - node.half), near_y = std::max(0.f, fabsf(dy) - node.half);
+        return near_x*near_x + near_y*near_y <= radius_squared;
+    }
+
+    // The members of every leaf in range of the primary, through the flock's
+    // own Update
+    template<typename FlockType>
+    void UpdateCandidates(FlockType& flock, size_t primary, std::vector<uint32_t>& stack, std::vector<uint32_t>& candidates) const
+    {
+        float radius = flock.InteractionRadius();
+        float p[2] = {tree_location[0][primary], tree_location[1][primary]};
+        candidates.clear();
+        stack.clear();
+        stack.push_back(0);
+        while(!stack.empty())
+        {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            if(node.count == 0.f || !InRange(node, p, radius*radius, flock.periodic)) continue;
+            if(node.first_child >= 0)
+            {
+                for(int32_t c = 0; c < 4; c++)
+                    stack.push_back(static_cast<uint32_t>(node.first_child + c));
+                continue;
+            }
+            candidates.insert(candidates.end(), order.begin() + node.begin, order.begin() + node.end);
+        }
+        flock.Update(primary, candidates.begin(), candidates.end());
+    }
+
+    template<typename Storage>
+    void UpdateBoid(BasicFlock<Storage>& flock, size_t primary, std::vector<uint32_t>& stack) const
+    {
+        typedef BasicFlock<Storage> FlockType;
+        const bool periodic = flock.periodic;
+        float radius = flock.InteractionRadius();
+        float radius_squared = radius*radius;
+        float p[2] = {tree_location[0][primary], tree_location[1][primary]};
+        typename FlockType::NeighborSums sums;
+
+        stack.clear();
+        stack.push_back(0);
+        while(!stack.empty())
+        {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            if(node.count == 0.f) continue;
+
+            float dx = p[0] - node.x, dy = p[1] - node.y;
+            if(periodic)
+            {
+                dx = MinimumImage(dx);
+                dy = MinimumImage(dy);
+            }
+            float near_x = std::max(0.f, fabsf(dx) - node.half), near_y = std::max(0.f, fabsf(dy) - node.half);
+            if(near_x*near_x + near_y*near_y > radius_squared) continue;
+
+            // Closed bounds so a boid on an edge opens both sides rather than neither
+            bool contains_primary = p[0] >= node.x - node.half && p[0] <= node.x + node.half &&
+                                    p[1] >= node.y - node.half && p[1] <= node.y + node.half;
+            float far_x = fabsf(dx) + node.half, far_y = fabsf(dy) + node.half;
+            if(!contains_primary && far_x*far_x + far_y*far_y <= radius_squared)
+            {
+                float offset[2];
+                for(size_t d = 0; d < 2; d++)
+                {
+                    offset[d] = p[d] - node.location_sum[d]/node.count;
+                    if(periodic) offset[d] = MinimumImage(offset[d]);
+                }
+                float dist = offset[0]*offset[0] + offset[1]*offset[1];
+                float side = 2.f*node.half;
+                if(side*side < theta*theta*dist)
+                {
+                    FlockType::AddNeighbor(sums, p, offset, dist, node.velocity_sum, node.count);
+                    continue;
+                }
+            }
+
+            if(node.first_child >= 0)
+            {
+                for(int32_t c = 0; c < 4; c++)
+                    stack.push_back(static_cast<uint32_t>(node.first_child + c));
+                continue;
+            }
+
+            for(uint32_t m = node.begin; m < node.end; m++)
+            {
+                uint32_t secondary = order[m];
+                if(secondary == primary) continue;
+                float offset[2], secondary_velocity[2];
+                for(size_t d = 0; d < 2; d++)
+                {
+                    offset[d] = p[d] - tree_location[d][secondary];
+                    if(periodic) offset[d] = MinimumImage(offset[d]);
+                    secondary_velocity[d] = velocity[d][secondary];
+                }
+                float dist = offset[0]*offset[0] + offset[1]*offset[1];
+                if(dist > radius_squared) continue;
+                FlockType::AddNeighbor(sums, p, offset, dist, secondary_velocity);
+            }
+        }
+
+        // Sums were taken in tree space, move the location sum back to world space
+        for(size_t d = 0; d < 2; d++)
+            sums.location[d] += sums.count*(flock.GetLocation(d, primary) - p[d]);
+        flock.Finish(primary, sums);
+    }
+};
+
+#endif
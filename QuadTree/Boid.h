@@ -2,165 +2,470 @@
 #define BOID_H
 
 #include "Quadtree.h"
+#include "Parallel.h"
+#include "Storage.h"
+#include <cstdint>
+#include <cstring>
 #include <stdexcept>
 #include <math.h>
 
-typedef std::vector<size_t> size_t_vector;
+template<size_t N>
+void CapVector(float (&vector)[N], float max_magnitude_squared, float min_magnitude_squared);
+template<size_t N>
+void NormalizeVectorInPlace(float (&vector)[N], float magnitude);
+inline float Q_rsqrt(float number);
 
-class Flock;
-class Boid;
+// Shortest displacement between two coordinates on the [-1,1] torus
+inline float MinimumImage(float delta)
+{
+    if(delta > 1.f) return delta-2.f;
+    if(delta < -1.f) return delta+2.f;
+    return delta;
+}
 
-template<typename T>
-void CapVector(std::vector<T>& vector, T max_magnitude_squared, T min_magnitude_squared);
-template<typename T>
-std::vector<T> NormalizeVectorCopy(std::vector<T> vector, T magnitude);
-template<typename T>
-void NormalizeVectorInPlace(std::vector<T>& vector, T magnitude);
-inline float Q_rsqrt(float number);
+// The tunable limits of a flock, for setting them from outside in one go
+struct FlockParameters
+{
+    float max_dist = 0.04f; // Squared interaction radius
+    float max_acceleration_magnitude = 0.0005f;
+    float max_velocity_magnitude = 0.01f;
+};
 
-class Boid
+// Storage picks how location and velocity are kept in memory (see Storage.h),
+// every kernel loads them into fp32 registers. Dimension is 2 (the plane) or 3.
+template<typename Storage = FloatStorage, size_t Dimension = 2>
+class BasicFlock
 {
+    static_assert(Dimension == 2 || Dimension == 3, "Flocks are 2D or 3D");
+
 public:
-    std::vector<float> location;
-    std::vector<float> velocity;
-    std::vector<float> acceleration;
-    Boid(std::vector<float> location, std::vector<float> velocity) : location(location), velocity(velocity), acceleration(location.size(), 0.f)
+    static const size_t dimension = Dimension;
+    typedef typename Storage::location_type location_type;
+    typedef typename Storage::velocity_type velocity_type;
+
+    // Structure of arrays, component d of boid i is location[d][i]. The
+    // storage's allocator decides where the pages come from (see Numa.h).
+    std::vector<location_type, typename Storage::template allocator<location_type> > location[dimension];
+    std::vector<velocity_type, typename Storage::template allocator<velocity_type> > velocity[dimension];
+    std::vector<float, typename Storage::template allocator<float> > acceleration[dimension];
+
+    BasicFlock() {};
+
+    BasicFlock(float max_dist, float max_acceleration_magnitude, float max_velocity_magnitude = 0.01f) :
+    max_dist(max_dist),
+    max_acceleration_magnitude(max_acceleration_magnitude),
+    max_velocity_magnitude(max_velocity_magnitude)
+    {};
+
+    // Changes the limits while keeping the boids and their allocations
+    void SetParameters(const FlockParameters& parameters)
     {
-        if(location.size()!= velocity.size()) throw "Incorrect dimensionality between location and velocity";
+        max_dist = parameters.max_dist;
+        max_acceleration_magnitude = parameters.max_acceleration_magnitude;
+        max_velocity_magnitude = parameters.max_velocity_magnitude;
     }
 
-    Boid(std::vector<float> location) : location(location), velocity(location.size(), 0.f), acceleration(location.size(), 0.f) {};
+    FlockParameters Parameters() const
+    {
+        FlockParameters retval;
+        retval.max_dist = max_dist;
+        retval.max_acceleration_magnitude = max_acceleration_magnitude;
+        retval.max_velocity_magnitude = max_velocity_magnitude;
+        return retval;
+    }
+
+    size_t size() const { return location[0].size(); }
 
-    void EmptyAcceleration()
+    // New boids are value initialised, which is the stored 0 for every
+    // storage. Allocators that defer first touch (PlacedAllocator) leave them
+    // unwritten instead, for a parallel spawn to place.
+    void Resize(size_t count)
     {
-        for(size_t i = 0; i<velocity.size(); i++)
+        for(size_t d = 0; d < dimension; d++)
         {
-            velocity[i] += acceleration[i];
-            acceleration[i] = 0.f;
+            location[d].resize(count);
+            velocity[d].resize(count);
+            acceleration[d].resize(count);
         }
-    } 
-};
+    }
 
-class Flock
-{
-public:
-    friend class Boid;
-    std::vector<Boid> boids;
+    float GetLocation(size_t d, size_t i) const { return Storage::LoadLocation(location[d][i]); }
+    float GetVelocity(size_t d, size_t i) const { return Storage::LoadVelocity(velocity[d][i]); }
+    void SetLocation(size_t d, size_t i, float value) { location[d][i] = Storage::StoreLocation(value); }
+    void SetVelocity(size_t d, size_t i, float value) { velocity[d][i] = Storage::StoreVelocity(value); }
+
+    // Accumulates the flocking rules for every boid in one leaf into acceleration.
+    // Positions and velocities are untouched until Integrate()
+    void Update(const size_t_vector& miniFlock)
+    {
+        periodic ? UpdateLeaf<true>(miniFlock) : UpdateLeaf<false>(miniFlock);
+    }
 
-    Flock() {};
+    // Same rules for a single boid against any candidate range, for indices
+    // other than the quadtree. Only the primary's acceleration is written.
+    template<typename Iterator>
+    void Update(size_t primary, Iterator begin, Iterator end)
+    {
+        periodic ? UpdateBoid<true, true>(primary, begin, end) : UpdateBoid<false, true>(primary, begin, end);
+    }
 
-    Flock(float max_dist, float max_acceleration_magnitude) :
-    max_dist(max_dist),
-    max_acceleration_magnitude(max_acceleration_magnitude) 
-    {};
+    // Same again for candidates that are neighbours whatever their distance,
+    // the k nearest say, so nothing is dropped for being out of range
+    template<typename Iterator>
+    void UpdateNeighbors(size_t primary, Iterator begin, Iterator end)
+    {
+        periodic ? UpdateBoid<true, false>(primary, begin, end) : UpdateBoid<false, false>(primary, begin, end);
+    }
+
+    float InteractionRadius() const { return sqrtf(max_dist); }
 
-    void Update(std::vector<Boid*>& miniFlock)
+    // Running totals of one boid's neighbourhood, gathered by any index and
+    // turned into acceleration by Finish()
+    struct NeighborSums
     {
-        for(Boid* primary_elm: miniFlock)
+        float seperation[dimension] = {};
+        float location[dimension] = {};
+        float velocity[dimension] = {};
+        float count = 0.f;
+    };
+
+    // Adds `weight` boids at `offset` (primary minus neighbour, already wrapped)
+    // whose velocities sum to velocity_sum. Neighbours count at their image
+    // closest to the primary.
+    static void AddNeighbor(NeighborSums& sums, const float (&primary_location)[dimension], const float (&offset)[dimension], float dist, const float (&velocity_sum)[dimension], float weight = 1.f)
+    {
+        sums.count += weight;
+        Seperation(sums.seperation, offset, dist, weight);
+        for(size_t d = 0; d < dimension; d++)
         {
-            CapVector(primary_elm->velocity, max_velocity_magnitude, max_velocity_magnitude/8);
-            for(size_t i = 0; i < primary_elm->location.size(); i++)
-                primary_elm->location[i]+=primary_elm->velocity[i];
+            sums.location[d] += weight*(primary_location[d]-offset[d]);
+            sums.velocity[d] += velocity_sum[d];
         }
-        
-        if(miniFlock.size() < 2) return;
+    }
 
-        for(Boid* primary_elm: miniFlock)
+    // Separation only, for indices that gather the averages some other way
+    static void AddSeperation(NeighborSums& sums, const float (&offset)[dimension], float dist, float weight = 1.f)
+    {
+        Seperation(sums.seperation, offset, dist, weight);
+    }
+
+    // Both boids of one pair within range, a and b each get what AddNeighbor
+    // would give them from their own side. offset is a minus b, wrapped. The
+    // separation term is computed once and added with opposite signs.
+    static void AddPair(NeighborSums& a, NeighborSums& b, const float (&a_location)[dimension], const float (&b_location)[dimension], const float (&offset)[dimension], float dist, const float (&a_velocity)[dimension], const float (&b_velocity)[dimension])
+    {
+        a.count += 1.f;
+        b.count += 1.f;
+        float push[dimension] = {};
+        Seperation(push, offset, dist, 1.f);
+        for(size_t d = 0; d < dimension; d++)
         {
-            std::vector<float> average_velocity(primary_elm->location.size(), 0);
-            std::vector<float> average_location(primary_elm->location.size(), 0);
-            size_t valid_boid_count = 0;
+            a.seperation[d] += push[d];
+            b.seperation[d] -= push[d];
+            a.location[d] += a_location[d]-offset[d];
+            b.location[d] += b_location[d]+offset[d];
+            a.velocity[d] += b_velocity[d];
+            b.velocity[d] += a_velocity[d];
+        }
+    }
 
-            for(Boid* secondary_elm: miniFlock)
-            {
-                if(primary_elm == secondary_elm) continue;
-                float dist = SquaredDistance<float>(primary_elm->location, secondary_elm->location);
-                if(dist > max_dist) continue;
-                valid_boid_count++;
-                Seperation(primary_elm, secondary_elm, dist);
-                
-                size_t ind = 0;
-                for(auto scalar: secondary_elm->location)
-                    average_location[ind++]+=scalar;
-
-                ind = 0;
-                for(auto scalar: secondary_elm->velocity)
-                    average_velocity[ind++]+=scalar;
-            }
-            if(!valid_boid_count) continue;
-            
-            CapVector(primary_elm->acceleration, max_acceleration_magnitude,max_acceleration_magnitude);
-            for(auto& elm: average_location)
-                elm/=valid_boid_count;
+    // Applies separation, alignment and cohesion for one boid from its sums
+    void Finish(size_t primary, const NeighborSums& sums)
+    {
+        if(sums.count == 0.f) return;
+
+        float primary_location[dimension], primary_velocity[dimension], primary_acceleration[dimension];
+        float average_velocity[dimension], average_location[dimension];
+        for(size_t d = 0; d < dimension; d++)
+        {
+            primary_location[d] = GetLocation(d, primary);
+            primary_velocity[d] = GetVelocity(d, primary);
+            primary_acceleration[d] = acceleration[d][primary] + sums.seperation[d];
+            average_location[d] = sums.location[d]/sums.count;
+            average_velocity[d] = sums.velocity[d]/sums.count;
+        }
+
+        CapVector(primary_acceleration, max_acceleration_magnitude, max_acceleration_magnitude);
+        Alignment(primary_acceleration, primary_velocity, average_velocity);
+        Cohesion(primary_acceleration, primary_location, primary_velocity, average_location);
+
+        for(size_t d = 0; d < dimension; d++)
+            acceleration[d][primary] = primary_acceleration[d];
+    }
+
+    // Quadtree coordinate of boid i along d. On the torus the tree origin is
+    // shifted every step (see ShiftTree) so no split line stays on the wrap seam
+    float TreeLocation(size_t d, size_t i) const
+    {
+        float val = GetLocation(d, i) + tree_shift[d];
+        if(val > 1.f) val-=2.f;
+        else if(val < -1.f) val+=2.f;
+        return val;
+    }
+
+    // Moves the tree origin along an R2 (R3 in 3D) low-discrepancy sequence
+    void ShiftTree(size_t step)
+    {
+        if(!periodic) return;
+        const float r2[2] = {0.7548776662f, 0.5698402910f};
+        const float r3[3] = {0.8191725134f, 0.6710436067f, 0.5497004779f};
+        const float* alpha = dimension == 3 ? r3 : r2;
+        for(size_t d = 0; d < dimension; d++)
+        {
+            float frac = 0.5f + step*alpha[d];
+            tree_shift[d] = 2.f*(frac - floorf(frac)) - 1.f;
+        }
+    }
+
+    // Fused integrator, one streaming pass over the flock per step:
+    // cap and apply acceleration, cap velocity, move, then wrap to the [-1,1] torus
+    void Integrate()
+    {
+        ParallelFor(0, size(), [this](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+                IntegrateBoid(i);
+        });
+    }
+
+    // Integrates just the boids of one leaf, for schedules that advance a
+    // leaf as soon as its own update is done (see TaskGraph.h)
+    void Integrate(const size_t_vector& miniFlock)
+    {
+        for(size_t i: miniFlock)
+            IntegrateBoid(i);
+    }
 
-            for(auto& elm: average_velocity)
-                elm/=valid_boid_count;
+private:
+    void IntegrateBoid(size_t i)
+    {
+        float a[dimension], v[dimension];
+        for(size_t d = 0; d < dimension; d++)
+        {
+            a[d] = acceleration[d][i];
+            v[d] = GetVelocity(d, i);
+        }
 
-            Alignment(primary_elm, average_velocity);
-            Cohesion(primary_elm, average_location);
+        CapVector(a, max_acceleration_magnitude, max_acceleration_magnitude);
+        for(size_t d = 0; d < dimension; d++)
+            v[d] += a[d];
+        CapVector(v, max_velocity_magnitude, max_velocity_magnitude/8);
+
+        for(size_t d = 0; d < dimension; d++)
+        {
+            SetLocation(d, i, MinimumImage(GetLocation(d, i) + v[d]));
+            SetVelocity(d, i, v[d]);
+            acceleration[d][i] = 0.f;
         }
+    }
 
-        for(Boid* primary_elm: miniFlock)
+    template<bool Periodic>
+    void UpdateLeaf(const size_t_vector& miniFlock)
+    {
+        size_t count = miniFlock.size();
+        if(count < 2) return;
+
+        if(small_leaf_kernels)
         {
-            CapVector<float>(primary_elm->acceleration, max_acceleration_magnitude, max_acceleration_magnitude);
-            primary_elm->EmptyAcceleration();
+            if(count <= 4) return UpdateSmallLeaf<Periodic, 4>(miniFlock);
+            if(count <= 8) return UpdateSmallLeaf<Periodic, 8>(miniFlock);
+            if(count <= 16) return UpdateSmallLeaf<Periodic, 16>(miniFlock);
+            if(count <= 32) return UpdateSmallLeaf<Periodic, 32>(miniFlock);
         }
+        if(symmetric_pairs) return UpdateLeafSymmetric<Periodic>(miniFlock);
+
+        for(size_t primary: miniFlock)
+            UpdateBoid<Periodic, true>(primary, miniFlock.begin(), miniFlock.end());
     }
 
-    void Mirror()
+    // Every unordered pair of the leaf once, scattered to both boids. A boid
+    // receives its pairs in leaf order, as UpdateBoid would sum them, so the
+    // result is the same with half the distance tests.
+    template<bool Periodic>
+    void UpdateLeafSymmetric(const size_t_vector& miniFlock)
     {
-        for(auto& boid: boids)
+        const size_t count = miniFlock.size();
+        thread_local std::vector<NeighborSums> sums;
+        sums.assign(count, NeighborSums());
+        for(size_t a = 0; a < count; a++)
         {
-            for(auto& val: boid.location)
+            float a_location[dimension], a_velocity[dimension];
+            for(size_t d = 0; d < dimension; d++)
+            {
+                a_location[d] = GetLocation(d, miniFlock[a]);
+                a_velocity[d] = GetVelocity(d, miniFlock[a]);
+            }
+            for(size_t b = a + 1; b < count; b++)
             {
-                if(val > 1.f) val-=2.f;
-                else if(val < -1.f) val+=2.f;
+                float b_location[dimension], offset[dimension];
+                for(size_t d = 0; d < dimension; d++)
+                {
+                    b_location[d] = GetLocation(d, miniFlock[b]);
+                    offset[d] = Periodic ? MinimumImage(a_location[d]-b_location[d]) : a_location[d]-b_location[d];
+                }
+                float dist = SquaredLength(offset);
+                if(dist > max_dist) continue;
+                float b_velocity[dimension];
+                for(size_t d = 0; d < dimension; d++)
+                    b_velocity[d] = GetVelocity(d, miniFlock[b]);
+                AddPair(sums[a], sums[b], a_location, b_location, offset, dist, a_velocity, b_velocity);
             }
         }
+
+        for(size_t k = 0; k < count; k++)
+            Finish(miniFlock[k], sums[k]);
     }
 
-private:
-    template<typename T>
-    T SquaredDistance(std::vector<T>& A, std::vector<T>& B)
+    // Leaf of at most N boids as a whole pair matrix. The leaf is gathered into
+    // fixed size arrays and every one of the N primary lanes (padding included,
+    // its results are dropped) meets every secondary. Pairs out of range and
+    // the boid itself get weight 0 instead of a branch, so each inner loop is
+    // a fixed length loop the compiler vectorizes. Each lane sums its
+    // secondaries in leaf order, as UpdateBoid does.
+    template<bool Periodic, size_t N>
+    void UpdateSmallLeaf(const size_t_vector& miniFlock)
     {
-        if(A.size() != B.size()) throw std::runtime_error("Unequal Dimensions between two Boids!");
+        const size_t count = miniFlock.size();
+        float location[dimension][N] = {}, velocity[dimension][N] = {};
+        for(size_t k = 0; k < count; k++)
+            for(size_t d = 0; d < dimension; d++)
+            {
+                location[d][k] = GetLocation(d, miniFlock[k]);
+                velocity[d][k] = GetVelocity(d, miniFlock[k]);
+            }
+
+        // One short loop per quantity, each a straight run over the N lanes
+        const float limit = max_dist;
+        float seperation[dimension][N] = {}, location_sum[dimension][N] = {}, velocity_sum[dimension][N] = {}, neighbors[N] = {};
+        for(size_t j = 0; j < count; j++)
+        {
+            float offset[dimension][N], dist[N] = {}, weight[N], scale[N];
+            for(size_t d = 0; d < dimension; d++)
+                for(size_t i = 0; i < N; i++)
+                {
+                    float delta = location[d][i] - location[d][j];
+                    if(Periodic) delta += (delta > 1.f ? -2.f : 0.f) + (delta < -1.f ? 2.f : 0.f);
+                    offset[d][i] = delta;
+                    dist[i] += delta*delta;
+                }
+            for(size_t i = 0; i < N; i++)
+                weight[i] = static_cast<float>(dist[i] <= limit);
+            // The same clamp to min_seperation_distance as Seperation, so the
+            // kernels match the generic loop bit for bit. Written as a select
+            // rather than fmaxf, which gcc will not vectorise without
+            // -ffast-math; it gives the same value for every input, NaN too.
+            for(size_t i = 0; i < N; i++)
+            {
+                float distance = dist[i] > min_seperation_distance ? dist[i] : min_seperation_distance;
+                scale[i] = distance*distance;
+            }
+            weight[j] = 0.f;
+            for(size_t i = 0; i < N; i++)
+                neighbors[i] += weight[i];
+            for(size_t d = 0; d < dimension; d++)
+                for(size_t i = 0; i < N; i++)
+                {
+                    seperation[d][i] += weight[i]*offset[d][i]/scale[i];
+                    location_sum[d][i] += weight[i]*(location[d][i] - offset[d][i]);
+                    velocity_sum[d][i] += weight[i]*velocity[d][j];
+                }
+        }
+
+        for(size_t k = 0; k < count; k++)
+        {
+            NeighborSums sums;
+            sums.count = neighbors[k];
+            for(size_t d = 0; d < dimension; d++)
+            {
+                sums.seperation[d] = seperation[d][k];
+                sums.location[d] = location_sum[d][k];
+                sums.velocity[d] = velocity_sum[d][k];
+            }
+            Finish(miniFlock[k], sums);
+        }
+    }
+
+    // Accumulates the rules for one boid against the candidates in [begin, end)
+    template<bool Periodic, bool InRangeOnly, typename Iterator>
+    void UpdateBoid(size_t primary, Iterator begin, Iterator end)
+    {
+        float primary_location[dimension];
+        for(size_t d = 0; d < dimension; d++)
+            primary_location[d] = GetLocation(d, primary);
+        NeighborSums sums;
+
+        for(Iterator iter = begin; iter != end; ++iter)
+        {
+            size_t secondary = *iter;
+            if(primary == secondary) continue;
+            float offset[dimension], secondary_velocity[dimension];
+            for(size_t d = 0; d < dimension; d++)
+                offset[d] = Periodic ? MinimumImage(primary_location[d]-GetLocation(d, secondary)) : primary_location[d]-GetLocation(d, secondary);
+            float dist = SquaredLength(offset);
+            if(InRangeOnly && dist > max_dist) continue;
+            for(size_t d = 0; d < dimension; d++)
+                secondary_velocity[d] = GetVelocity(d, secondary);
+            AddNeighbor(sums, primary_location, offset, dist, secondary_velocity);
+        }
 
-        T retval = 0;
-        for(size_t i = 0; i < A.size(); i++)
-            retval += (A[i]-B[i])*(A[i]-B[i]);
+        Finish(primary, sums);
+    }
+
+    template<size_t N>
+    static float SquaredLength(const float (&A)[N])
+    {
+        float retval = 0;
+        for(size_t i = 0; i < N; i++)
+            retval += A[i]*A[i];
 
         return retval;
     }
 
-    void Seperation(Boid* const a, Boid* const b, float distance)
+    static void Seperation(float (&acceleration)[dimension], const float (&offset)[dimension], float distance, float weight)
     {
-        if(a==b || distance == 0.f) return;
-        for(size_t i = 0; i < a->location.size(); i++)
-            a->acceleration[i] += (a->location[i]-b->location[i])/(distance*distance);
+        if(distance == 0.f) return;
+        // Near-coincident boids would overflow to inf and poison CapVector with NaN
+        distance = fmaxf(distance, min_seperation_distance);
+        for(size_t i = 0; i < dimension; i++)
+            acceleration[i] += weight*offset[i]/(distance*distance);
     }
 
-    void Alignment(Boid* const target, std::vector<float>& averageVelocity)
+    void Alignment(float (&acceleration)[dimension], const float (&velocity)[dimension], const float (&averageVelocity)[dimension])
     {
-        std::vector<float> retval(averageVelocity.size(), 0.f);
-        size_t ind = 0;
-        for(auto& elm: retval)
-            elm+=(averageVelocity[ind]-target->velocity[ind]), ind++;
+        float retval[dimension];
+        for(size_t i = 0; i < dimension; i++)
+            retval[i] = averageVelocity[i]-velocity[i];
         CapVector(retval, max_acceleration_magnitude, max_acceleration_magnitude);
-        for(size_t i = 0; i < target->acceleration.size(); i++)
-            target->acceleration[i]+=retval[i];
+        for(size_t i = 0; i < dimension; i++)
+            acceleration[i]+=retval[i];
     }
 
-    void Cohesion(Boid* const target, std::vector<float>& averageLocation)
+    void Cohesion(float (&acceleration)[dimension], const float (&location)[dimension], const float (&velocity)[dimension], const float (&averageLocation)[dimension])
     {
-        std::vector<float> retval(averageLocation.size(), 0.f);
-        size_t ind = 0;
-        for(auto& elm: retval)
-            elm += (averageLocation[ind]-target->location[ind]-target->velocity[ind]), ind++;
+        float retval[dimension];
+        for(size_t i = 0; i < dimension; i++)
+            retval[i] = averageLocation[i]-location[i]-velocity[i];
         CapVector(retval, max_acceleration_magnitude, max_acceleration_magnitude);
-        for(size_t i = 0; i < target->acceleration.size(); i++)
-            target->acceleration[i]+=retval[i];
+        for(size_t i = 0; i < dimension; i++)
+            acceleration[i]+=retval[i];
     }
 
+public:
+    // Treat [-1,1] as a torus when searching for neighbours
+    bool periodic = true;
+    // Leaves of up to 32 boids go through the fixed size kernels
+    bool small_leaf_kernels = true;
+    // Larger leaves test each pair once and update both boids
+    bool symmetric_pairs = true;
+    float tree_shift[dimension] = {};
+    // Update runs the three rules above, so indices may gather NeighborSums
+    // and call Finish() themselves. Flocks with other rules clear this and
+    // get their own Update called instead.
+    static constexpr bool builtin_rules = true;
+    // Separation distances are clamped up to this, so a near coincident pair
+    // cannot blow up the 1/distance^2 push
+    static constexpr float min_seperation_distance = 1e-10f;
+
 private:
     float max_dist = 0.04f; // Max squared distance for a Boid to be in the flock
     float max_acceleration_magnitude = 0.0005f;
@@ -168,12 +473,17 @@ private:
 
 };
 
-inline void base_split(point_bucket<Boid>& base, size_t max_size, std::vector<point_bucket<Boid> >& tree, size_t numberOfSeperations)
+typedef BasicFlock<> Flock;
+typedef BasicFlock<FloatStorage, 3> Flock3D;
+
+template<typename Storage>
+void base_split(const BasicFlock<Storage>& flock, point_bucket& base, size_t max_size, std::vector<point_bucket>& tree, size_t numberOfSeperations)
 {
-    //Empty starting buck et
+    // Small enough, or out of depth: a leaf either way, however full, so
+    // every boid ends up in exactly one leaf
     if(base.bucket.size() <= max_size || numberOfSeperations == 0 ) 
     {
-        if(tree.empty()) tree.push_back(base);
+        tree.push_back(base);
         return;
     }
         
@@ -181,16 +491,14 @@ inline void base_split(point_bucket<Boid>& base, size_t max_size, std::vector<po
     base.x_length/=2;
     base.y_length/=2;
 
-    point_bucket<Boid> NW(base.x - base.x_length/2, base.y + base.y_length/2, base.x_length, base.y_length);
-    point_bucket<Boid> SW(base.x - base.x_length/2, base.y - base.y_length/2, base.x_length, base.y_length);
-    point_bucket<Boid> SE(base.x + base.x_length/2, base.y - base.y_length/2, base.x_length, base.y_length);
+    point_bucket NW(base.x - base.x_length/2, base.y + base.y_length/2, base.x_length, base.y_length);
+    point_bucket SW(base.x - base.x_length/2, base.y - base.y_length/2, base.x_length, base.y_length);
+    point_bucket SE(base.x + base.x_length/2, base.y - base.y_length/2, base.x_length, base.y_length);
 
-    std::vector<Boid*> base_extra_bucket;
+    size_t_vector base_extra_bucket;
     for(auto iter = base.bucket.rbegin(); iter < base.bucket.rend(); iter++)
     {
-        auto& elm = (*iter)->location;
-
-        switch (static_cast<char>(elm[0] < base.x) + 2*static_cast<char>((elm[1] < base.y))) {
+        switch (static_cast<char>(flock.TreeLocation(0, *iter) < base.x) + 2*static_cast<char>((flock.TreeLocation(1, *iter) < base.y))) {
         case 0:
             base_extra_bucket.push_back(*iter);
             break;
@@ -216,21 +524,57 @@ inline void base_split(point_bucket<Boid>& base, size_t max_size, std::vector<po
     numberOfSeperations--;
 
     if(!base.bucket.empty()) 
-        base.bucket.size() > max_size ? base_split(base, max_size, tree, numberOfSeperations):tree.push_back(base);
+        base.bucket.size() > max_size ? base_split(flock, base, max_size, tree, numberOfSeperations):tree.push_back(base);
     if(!NW.bucket.empty()) 
-        NW.bucket.size() > max_size ? base_split(NW, max_size, tree, numberOfSeperations):tree.push_back(NW);
+        NW.bucket.size() > max_size ? base_split(flock, NW, max_size, tree, numberOfSeperations):tree.push_back(NW);
     if(!SW.bucket.empty()) 
-        SW.bucket.size() > max_size ? base_split(SW, max_size, tree, numberOfSeperations):tree.push_back(SW);
+        SW.bucket.size() > max_size ? base_split(flock, SW, max_size, tree, numberOfSeperations):tree.push_back(SW);
     if(!SE.bucket.empty()) 
-        SE.bucket.size() > max_size ? base_split(SE, max_size, tree, numberOfSeperations):tree.push_back(SE);
+        SE.bucket.size() > max_size ? base_split(flock, SE, max_size, tree, numberOfSeperations):tree.push_back(SE);
 }
 
-template<typename T>
-void CapVector(std::vector<T>& vector, T max_magnitude, T min_magnitude)
+// base_split for any dimension: every box over max_size is cut into 2^Dimension
+// children at its center (an octree in 3D) until depth runs out. Leaves are
+// appended to tree.
+template<typename Storage, size_t Dimension>
+void orthant_split(const BasicFlock<Storage, Dimension>& flock, orthant_bucket<Dimension>& base, size_t max_size, std::vector<orthant_bucket<Dimension> >& tree, size_t depth)
 {
-    T vector_scaled_magnitude, vector_magnitude_squared = 0;
+    if(base.bucket.empty()) return;
+    if(base.bucket.size() <= max_size || depth == 0)
+    {
+        tree.push_back(std::move(base));
+        return;
+    }
+
+    const size_t children = size_t(1) << Dimension;
+    orthant_bucket<Dimension> child[children];
+    for(size_t c = 0; c < children; c++)
+        for(size_t d = 0; d < Dimension; d++)
+        {
+            child[c].length[d] = base.length[d]/2;
+            child[c].center[d] = base.center[d] + (((c >> d) & 1) ? base.length[d]/4 : -base.length[d]/4);
+        }
 
-    for(T& elm: vector) vector_magnitude_squared+=(elm*elm);
+    // Bit d of the child index is set on the high side of axis d
+    for(size_t i: base.bucket)
+    {
+        size_t c = 0;
+        for(size_t d = 0; d < Dimension; d++)
+            c |= static_cast<size_t>(flock.TreeLocation(d, i) >= base.center[d]) << d;
+        child[c].bucket.push_back(i);
+    }
+    size_t_vector().swap(base.bucket);
+
+    for(size_t c = 0; c < children; c++)
+        orthant_split(flock, child[c], max_size, tree, depth - 1);
+}
+
+template<size_t N>
+void CapVector(float (&vector)[N], float max_magnitude, float min_magnitude)
+{
+    float vector_scaled_magnitude, vector_magnitude_squared = 0;
+
+    for(float elm: vector) vector_magnitude_squared+=(elm*elm);
 
     if(vector_magnitude_squared==0) return;
 
@@ -240,41 +584,22 @@ void CapVector(std::vector<T>& vector, T max_magnitude, T min_magnitude)
         vector_scaled_magnitude = min_magnitude*Q_rsqrt(vector_magnitude_squared);
     else return;
 
-    for(T& elm: vector) elm*=vector_scaled_magnitude;
-}
-
-
-template<typename T>
-std::vector<T> NormalizeVectorCopy(std::vector<T> vector, T magnitude)
-{
-    float sum, inv;
-
-    sum = 0.f;
-    for(T elm: vector)
-        sum+=(elm*elm);
-    
-    if(sum==0) return vector;
-
-    inv = Q_rsqrt(sum)*magnitude;
-    for(T& elm: vector)
-        elm*=inv;
-
-    return vector;
+    for(float& elm: vector) elm*=vector_scaled_magnitude;
 }
 
-template<typename T>
-void NormalizeVectorInPlace(std::vector<T>& vector, T magnitude)
+template<size_t N>
+void NormalizeVectorInPlace(float (&vector)[N], float magnitude)
 {
     float sum, inv;
 
     sum = 0.f;
-    for(T elm: vector)
+    for(float elm: vector)
         sum+=(elm*elm);
 
     if(sum==0) return;
 
     inv = Q_rsqrt(sum)*magnitude;
-    for(T& elm: vector)
+    for(float& elm: vector)
         elm*=inv;
 }
 
@@ -282,15 +607,15 @@ void NormalizeVectorInPlace(std::vector<T>& vector, T magnitude)
 inline float Q_rsqrt(float number)
 {
     if(number==0) throw std::runtime_error("Dividing by Zero");
-	long i;
+	int32_t i;
 	float x2, y;
 	const float threehalfs = 1.5F;
 
 	x2 = number * 0.5F;
 	y  = number;
-	i  = * ( long * ) &y;                       // evil floating point bit level hacking
+	std::memcpy(&i, &y, sizeof(i));             // evil floating point bit level hacking
 	i  = 0x5f3759df - ( i >> 1 );               // what the fuck? 
-	y  = * ( float * ) &i;
+	std::memcpy(&y, &i, sizeof(y));
 	y  = y * ( threehalfs - ( x2 * y * y ) );   // 1st iteration
 
 	return y;
@@ -0,0 +1,423 @@
+#ifndef DOMAIN_H
+#define DOMAIN_H
+
+#include "Boid.h"
+#include "Grid.h"
+#include "Spawn.h"
+#include <new>
+#include <string>
+
+#ifndef _WIN32
+#include <atomic>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#endif
+
+#ifdef FLOCK_USE_MPI
+#include <mpi.h>
+#endif
+
+// Moves float buffers between the processes of a decomposed simulation.
+// Exchange is collective: every rank calls it with one outgoing buffer per
+// rank and gets back one incoming buffer per rank.
+class Transport
+{
+public:
+    virtual ~Transport() {};
+    virtual size_t Rank() const = 0;
+    virtual size_t Size() const = 0;
+    virtual void Exchange(const std::vector<std::vector<float> >& outgoing, std::vector<std::vector<float> >& incoming) = 0;
+};
+
+#ifndef _WIN32
+// Ranks on one host sharing a POSIX shared memory segment: a mailbox per
+// (sender, receiver) pair and a barrier of lock-free atomics in the segment
+// (pthread_barrier_t is missing on macOS). One process calls Create() before
+// the ranks start (or fork), every rank then opens it by name.
+class ShmTransport : public Transport
+{
+public:
+    static void Create(const std::string& name, size_t ranks, size_t capacity)
+    {
+        int descriptor = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+        if(descriptor < 0) throw std::runtime_error("Could not create shared memory " + name);
+        size_t bytes = SegmentSize(ranks, capacity);
+        if(ftruncate(descriptor, static_cast<off_t>(bytes)) != 0)
+        {
+            close(descriptor);
+            throw std::runtime_error("Could not size shared memory " + name);
+        }
+        void* address = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+        close(descriptor);
+        if(address == MAP_FAILED) throw std::runtime_error("Could not map shared memory " + name);
+
+        Header* header = static_cast<Header*>(address);
+        header->ranks = ranks;
+        header->capacity = capacity;
+        new (&header->arrived) std::atomic<uint32_t>(0);
+        new (&header->generation) std::atomic<uint32_t>(0);
+        new (&header->overflow) std::atomic<uint32_t>(0);
+        new (&header->ready) std::atomic<uint32_t>(1);
+        munmap(address, bytes);
+    }
+
+    static void Remove(const std::string& name) { shm_unlink(name.c_str()); }
+
+    ShmTransport(const std::string& name, size_t rank) : rank(rank)
+    {
+        int descriptor = shm_open(name.c_str(), O_RDWR, 0600);
+        if(descriptor < 0) throw std::runtime_error("Could not open shared memory " + name);
+        struct stat info;
+        fstat(descriptor, &info);
+        bytes = static_cast<size_t>(info.st_size);
+        void* address = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+        close(descriptor);
+        if(address == MAP_FAILED) throw std::runtime_error("Could not map shared memory " + name);
+        header = static_cast<Header*>(address);
+        if(bytes < sizeof(Header) || header->ready.load() != 1 || rank >= header->ranks || bytes < SegmentSize(header->ranks, header->capacity))
+        {
+            munmap(address, bytes);
+            throw std::runtime_error(name + " is not a transport segment for rank " + std::to_string(rank));
+        }
+    }
+
+    ShmTransport(const ShmTransport&) = delete;
+    ShmTransport& operator=(const ShmTransport&) = delete;
+    ~ShmTransport() { munmap(header, bytes); }
+
+    size_t Rank() const override { return rank; }
+    size_t Size() const override { return header->ranks; }
+
+    // A buffer larger than the mailbox fails the exchange on every rank, not
+    // just the sender, so nobody is left waiting at the barrier. The segment
+    // cannot be used again after that.
+    void Exchange(const std::vector<std::vector<float> >& outgoing, std::vector<std::vector<float> >& incoming) override
+    {
+        size_t ranks = header->ranks;
+        bool fits = true;
+        for(size_t to = 0; to < ranks; to++)
+            fits &= outgoing[to].size() <= header->capacity;
+        if(!fits) header->overflow.store(1, std::memory_order_relaxed);
+        else
+            for(size_t to = 0; to < ranks; to++)
+            {
+                uint64_t* mailbox = Mailbox(rank, to);
+                mailbox[0] = outgoing[to].size();
+                std::memcpy(mailbox + 1, outgoing[to].data(), outgoing[to].size()*sizeof(float));
+            }
+        Wait();
+        if(header->overflow.load(std::memory_order_relaxed)) throw std::runtime_error("Exchange larger than the shared memory mailbox");
+
+        incoming.resize(ranks);
+        for(size_t from = 0; from < ranks; from++)
+        {
+            const uint64_t* mailbox = Mailbox(from, rank);
+            const float* data = reinterpret_cast<const float*>(mailbox + 1);
+            incoming[from].assign(data, data + mailbox[0]);
+        }
+        // Nobody refills a mailbox before its reader is done with it
+        Wait();
+    }
+
+private:
+    // Shared between processes, so the atomics must not hide a lock
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "Shared memory barrier needs lock-free atomics");
+
+    struct Header
+    {
+        std::atomic<uint32_t> ready;
+        std::atomic<uint32_t> arrived;      // Ranks at the barrier
+        std::atomic<uint32_t> generation;   // Barriers completed
+        std::atomic<uint32_t> overflow;     // A rank's buffer did not fit
+        size_t ranks;
+        size_t capacity;    // Floats per mailbox
+    };
+
+    Header* header = nullptr;
+    size_t bytes = 0;
+    size_t rank;
+
+    static size_t HeaderSize() { return (sizeof(Header) + 63)/64*64; }
+    static size_t MailboxSize(size_t capacity) { return (sizeof(uint64_t) + capacity*sizeof(float) + 63)/64*64; }
+    static size_t SegmentSize(size_t ranks, size_t capacity) { return HeaderSize() + ranks*ranks*MailboxSize(capacity); }
+
+    uint64_t* Mailbox(size_t from, size_t to) const
+    {
+        char* base = reinterpret_cast<char*>(header) + HeaderSize();
+        return reinterpret_cast<uint64_t*>(base + (from*header->ranks + to)*MailboxSize(header->capacity));
+    }
+
+    // The last rank to arrive resets the count and opens the next generation,
+    // the others yield until it does
+    void Wait()
+    {
+        uint32_t generation = header->generation.load(std::memory_order_acquire);
+        if(header->arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == header->ranks)
+        {
+            header->arrived.store(0, std::memory_order_relaxed);
+            header->generation.fetch_add(1, std::memory_order_release);
+            return;
+        }
+        while(header->generation.load(std::memory_order_acquire) == generation)
+            std::this_thread::yield();
+    }
+};
+#endif
+
+#ifdef FLOCK_USE_MPI
+// Ranks of MPI_COMM_WORLD, MPI_Init must already have been called
+class MpiTransport : public Transport
+{
+public:
+    MpiTransport()
+    {
+        int value;
+        MPI_Comm_rank(MPI_COMM_WORLD, &value);
+        rank = static_cast<size_t>(value);
+        MPI_Comm_size(MPI_COMM_WORLD, &value);
+        size = static_cast<size_t>(value);
+    }
+
+    size_t Rank() const override { return rank; }
+    size_t Size() const override { return size; }
+
+    void Exchange(const std::vector<std::vector<float> >& outgoing, std::vector<std::vector<float> >& incoming) override
+    {
+        std::vector<int> send_counts(size), receive_counts(size), send_offsets(size), receive_offsets(size);
+        std::vector<float> send;
+        for(size_t to = 0; to < size; to++)
+        {
+            send_counts[to] = static_cast<int>(outgoing[to].size());
+            send_offsets[to] = static_cast<int>(send.size());
+            send.insert(send.end(), outgoing[to].begin(), outgoing[to].end());
+        }
+        MPI_Alltoall(send_counts.data(), 1, MPI_INT, receive_counts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+
+        int total = 0;
+        for(size_t from = 0; from < size; from++)
+        {
+            receive_offsets[from] = total;
+            total += receive_counts[from];
+        }
+        std::vector<float> receive(static_cast<size_t>(total));
+        MPI_Alltoallv(send.data(), send_counts.data(), send_offsets.data(), MPI_FLOAT,
+                      receive.data(), receive_counts.data(), receive_offsets.data(), MPI_FLOAT, MPI_COMM_WORLD);
+
+        incoming.resize(size);
+        for(size_t from = 0; from < size; from++)
+            incoming[from].assign(receive.begin() + receive_offsets[from], receive.begin() + receive_offsets[from] + receive_counts[from]);
+    }
+
+private:
+    size_t rank, size;
+};
+#endif
+
+// One rank's share of a flock decomposed into tiles_x * tiles_y tiles of the
+// [-1,1] torus, rank r owning tile (r % tiles_x, r / tiles_x). Every step the
+// rank receives as halo the boids of other tiles within the interaction
+// radius of its own, updates its owned boids against owned plus halo, moves
+// them, then hands boids that left its tile to their new owners.
+class DomainFlock
+{
+public:
+    Flock flock;    // Owned boids only
+
+    DomainFlock(Transport& transport, size_t tiles_x, size_t tiles_y, const FlockParameters& parameters = FlockParameters()) :
+    transport(transport), tiles_x(tiles_x), tiles_y(tiles_y)
+    {
+        if(tiles_x*tiles_y != transport.Size()) throw std::runtime_error("One rank per tile");
+        flock.SetParameters(parameters);
+        local.SetParameters(parameters);
+        outgoing.resize(transport.Size());
+    }
+
+    // Spawns boids [rank*total/ranks, (rank+1)*total/ranks) of the global
+    // flock, then sends each to the rank owning its tile
+    void Spawn(size_t total, const SpawnConfig& config = SpawnConfig())
+    {
+        size_t ranks = transport.Size(), rank = transport.Rank();
+        size_t first = rank*total/ranks, last = (rank + 1)*total/ranks;
+        uint64_t key = SquaresKey(config.seed);
+        flock.Resize(last - first);
+        for(size_t i = first; i < last; i++)
+        {
+            float location[2], velocity[2];
+            SpawnBoid(config, key, i, location, velocity);
+            for(size_t d = 0; d < 2; d++)
+            {
+                flock.SetLocation(d, i - first, location[d]);
+                flock.SetVelocity(d, i - first, velocity[d]);
+                flock.acceleration[d][i - first] = 0.f;
+            }
+        }
+        Migrate();
+    }
+
+    void Step()
+    {
+        ExchangeHalo();
+        UpdateOwned();
+        flock.Integrate();
+        Migrate();
+    }
+
+    size_t HaloCount() const { return local.size() - flock.size(); }
+
+    size_t Owner(float x, float y) const
+    {
+        return TileCoordinate(y, tiles_y)*tiles_x + TileCoordinate(x, tiles_x);
+    }
+
+private:
+    static const size_t floats_per_boid = 4; // x, y, vx, vy
+
+    Transport& transport;
+    size_t tiles_x, tiles_y;
+    Flock local;    // Owned boids followed by the halo
+    UniformGrid grid;
+    std::vector<std::vector<float> > outgoing, incoming;
+
+    static size_t TileCoordinate(float val, size_t tiles)
+    {
+        long tile = static_cast<long>((val + 1.f)*0.5f*tiles);
+        return static_cast<size_t>(std::max(0L, std::min(tile, static_cast<long>(tiles) - 1)));
+    }
+
+    // Distance along one axis from val to the tile span [low, high]
+    float AxisDistance(float val, float low, float high) const
+    {
+        if(val >= low && val <= high) return 0.f;
+        if(!flock.periodic) return val < low ? low - val : val - high;
+        return std::min(fabsf(MinimumImage(val - low)), fabsf(MinimumImage(val - high)));
+    }
+
+    void Pack(std::vector<float>& buffer, size_t i) const
+    {
+        buffer.push_back(flock.GetLocation(0, i));
+        buffer.push_back(flock.GetLocation(1, i));
+        buffer.push_back(flock.GetVelocity(0, i));
+        buffer.push_back(flock.GetVelocity(1, i));
+    }
+
+    void ExchangeHalo()
+    {
+        for(auto& elm: outgoing)
+            elm.clear();
+        size_t rank = transport.Rank();
+        float radius = flock.InteractionRadius();
+        float width = 2.f/tiles_x, height = 2.f/tiles_y;
+        // Tiles narrower than the radius put more than the adjacent ones in reach
+        long reach_x = std::min<long>(static_cast<long>(tiles_x)/2, static_cast<long>(ceilf(radius/width)));
+        long reach_y = std::min<long>(static_cast<long>(tiles_y)/2, static_cast<long>(ceilf(radius/height)));
+        std::vector<size_t> sent_to(transport.Size(), ~size_t(0));
+
+        for(size_t i = 0; i < flock.size(); i++)
+        {
+            float x = flock.GetLocation(0, i), y = flock.GetLocation(1, i);
+            long tx = static_cast<long>(TileCoordinate(x, tiles_x)), ty = static_cast<long>(TileCoordinate(y, tiles_y));
+            for(long dy = -reach_y; dy <= reach_y; dy++)
+                for(long dx = -reach_x; dx <= reach_x; dx++)
+                {
+                    long nx = tx + dx, ny = ty + dy;
+                    if(!flock.periodic && (nx < 0 || ny < 0 || nx >= static_cast<long>(tiles_x) || ny >= static_cast<long>(tiles_y))) continue;
+                    nx = (nx + tiles_x)%tiles_x;
+                    ny = (ny + tiles_y)%tiles_y;
+                    size_t to = static_cast<size_t>(ny*tiles_x + nx);
+                    if(to == rank || sent_to[to] == i) continue;
+                    float ax = AxisDistance(x, -1.f + nx*width, -1.f + (nx + 1)*width);
+                    float ay = AxisDistance(y, -1.f + ny*height, -1.f + (ny + 1)*height);
+                    if(ax*ax + ay*ay > radius*radius) continue;
+                    sent_to[to] = i;
+                    Pack(outgoing[to], i);
+                }
+        }
+        transport.Exchange(outgoing, incoming);
+
+        size_t owned = flock.size(), halo = 0;
+        for(auto& elm: incoming)
+            halo += elm.size()/floats_per_boid;
+        local.periodic = flock.periodic;
+        local.Resize(owned + halo);
+        for(size_t i = 0; i < owned; i++)
+            for(size_t d = 0; d < 2; d++)
+            {
+                local.location[d][i] = flock.location[d][i];
+                local.velocity[d][i] = flock.velocity[d][i];
+                local.acceleration[d][i] = flock.acceleration[d][i];
+            }
+        size_t next = owned;
+        for(auto& elm: incoming)
+            for(size_t b = 0; b < elm.size(); b += floats_per_boid, next++)
+                for(size_t d = 0; d < 2; d++)
+                {
+                    local.SetLocation(d, next, elm[b + d]);
+                    local.SetVelocity(d, next, elm[b + 2 + d]);
+                }
+    }
+
+    void UpdateOwned()
+    {
+        grid.Build(local, local.InteractionRadius());
+        ParallelFor(0, flock.size(), [&](size_t begin, size_t end)
+        {
+            std::vector<uint32_t> candidates;
+            for(size_t i = begin; i < end; i++)
+            {
+                candidates.clear();
+                grid.ForEachNeighborCell(grid.CellCoordinate(local.GetLocation(0, i)), grid.CellCoordinate(local.GetLocation(1, i)), local.periodic, [&](size_t cell)
+                {
+                    candidates.insert(candidates.end(), grid.sorted.begin() + grid.cell_start[cell], grid.sorted.begin() + grid.cell_start[cell + 1]);
+                });
+                local.Update(i, candidates.begin(), candidates.end());
+                for(size_t d = 0; d < 2; d++)
+                    flock.acceleration[d][i] = local.acceleration[d][i];
+            }
+        });
+    }
+
+    // Swap-removes boids that left the tile and appends the ones arriving
+    void Migrate()
+    {
+        for(auto& elm: outgoing)
+            elm.clear();
+        size_t rank = transport.Rank();
+        for(size_t i = 0; i < flock.size();)
+        {
+            size_t owner = Owner(flock.GetLocation(0, i), flock.GetLocation(1, i));
+            if(owner == rank)
+            {
+                i++;
+                continue;
+            }
+            Pack(outgoing[owner], i);
+            size_t last = flock.size() - 1;
+            for(size_t d = 0; d < 2; d++)
+            {
+                flock.location[d][i] = flock.location[d][last];
+                flock.velocity[d][i] = flock.velocity[d][last];
+                flock.acceleration[d][i] = flock.acceleration[d][last];
+            }
+            flock.Resize(last);
+        }
+        transport.Exchange(outgoing, incoming);
+
+        size_t next = flock.size(), arriving = 0;
+        for(auto& elm: incoming)
+            arriving += elm.size()/floats_per_boid;
+        flock.Resize(next + arriving);
+        for(auto& elm: incoming)
+            for(size_t b = 0; b < elm.size(); b += floats_per_boid, next++)
+                for(size_t d = 0; d < 2; d++)
+                {
+                    flock.SetLocation(d, next, elm[b + d]);
+                    flock.SetVelocity(d, next, elm[b + 2 + d]);
+                    flock.acceleration[d][next] = 0.f;
+                }
+    }
+};
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include "Boid.h"
+#include "NeighborList.h"
+#include "Spawn.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+
+// One independent simulation of a parameter sweep
+struct EnsembleRun
+{
+    FlockParameters parameters;
+    SpawnConfig spawn;
+    size_t boids = 10000;
+    size_t steps = 100;
+};
+
+// What a run reports when it finishes
+struct EnsembleSummary
+{
+    size_t run;             // Index into the batch
+    double milliseconds;
+    float mean_speed;
+    float polarization;     // |mean velocity| / mean speed, 1 when all boids head the same way
+    size_t neighbor_builds;
+};
+
+// Runs a batch of independent flocks in one process, one flock per task.
+// Every worker owns a slot (flock plus neighbour list) that is reused from
+// run to run, so after the first few runs no step allocates. Workers pull
+// the next run from a shared counter, so uneven runs still fill the cores,
+// and the ParallelFor calls inside a run execute inline on the worker.
+class EnsembleRunner
+{
+public:
+    size_t workers = WorkerCount();
+    float skin_fraction = 0.25f; // Verlet skin relative to the run's interaction radius
+
+    // Calls report(summary) as each run finishes, in completion order and
+    // never concurrently
+    void Run(const std::vector<EnsembleRun>& runs, std::function<void(const EnsembleSummary&)> report)
+    {
+        size_t count = std::max<size_t>(1, std::min(workers, runs.size()));
+        while(slots.size() < count)
+            slots.emplace_back(0.f);
+
+        std::atomic<size_t> next(0);
+        std::mutex report_mutex;
+        ParallelFor(0, count, [&](size_t first, size_t last)
+        {
+            for(size_t w = first; w < last; w++)
+            {
+                for(size_t r = next++; r < runs.size(); r = next++)
+                {
+                    EnsembleSummary summary = Simulate(slots[w], runs[r]);
+                    summary.run = r;
+                    std::lock_guard<std::mutex> lock(report_mutex);
+                    report(summary);
+                }
+            }
+        }, count);
+    }
+
+private:
+    struct Slot
+    {
+        explicit Slot(float skin) : neighbors(skin) {};
+        Flock flock;
+        NeighborList neighbors;
+    };
+
+    std::vector<Slot> slots;
+
+    EnsembleSummary Simulate(Slot& slot, const EnsembleRun& run) const
+    {
+        auto start = std::chrono::steady_clock::now();
+        Flock& flock = slot.flock;
+        flock.SetParameters(run.parameters);
+        SpawnFlock(flock, run.boids, run.spawn);
+
+        NeighborList& neighbors = slot.neighbors;
+        neighbors.skin = skin_fraction*flock.InteractionRadius();
+        size_t builds = neighbors.builds;
+        // Same boid count as the previous run would pass the staleness check
+        neighbors.Build(flock);
+        for(size_t step = 0; step < run.steps; step++)
+        {
+            neighbors.Step(flock);
+            flock.Integrate();
+        }
+
+        EnsembleSummary summary = {};
+        float velocity_sum[2] = {}, speed_sum = 0.f;
+        for(size_t i = 0; i < flock.size(); i++)
+        {
+            float v[2] = {flock.GetVelocity(0, i), flock.GetVelocity(1, i)};
+            velocity_sum[0] += v[0];
+            velocity_sum[1] += v[1];
+            speed_sum += sqrtf(v[0]*v[0] + v[1]*v[1]);
+        }
+        float count = static_cast<float>(std::max<size_t>(1, flock.size()));
+        summary.mean_speed = speed_sum/count;
+        summary.polarization = speed_sum > 0.f ? sqrtf(velocity_sum[0]*velocity_sum[0] + velocity_sum[1]*velocity_sum[1])/speed_sum : 0.f;
+        summary.neighbor_builds = neighbors.builds - builds;
+        summary.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return summary;
+    }
+};
+
+#endif
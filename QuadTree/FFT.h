@@ -0,0 +1,71 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include "Parallel.h"
+#include <complex>
+#include <stdexcept>
+#include <vector>
+
+typedef std::complex<double> complex_type;
+
+inline bool IsPowerOfTwo(size_t n) { return n && !(n & (n - 1)); }
+
+// In place iterative radix-2 FFT of n (a power of two) values. The inverse
+// is unscaled, divide by n to undo a forward transform.
+inline void FFT(complex_type* data, size_t n, bool inverse)
+{
+    for(size_t i = 1, j = 0; i < n; i++)
+    {
+        size_t bit = n >> 1;
+        for(; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if(i < j) std::swap(data[i], data[j]);
+    }
+
+    const double pi = 3.14159265358979323846;
+    for(size_t length = 2; length <= n; length <<= 1)
+    {
+        double angle = (inverse ? 2.0 : -2.0)*pi/length;
+        complex_type step(cos(angle), sin(angle));
+        for(size_t start = 0; start < n; start += length)
+        {
+            complex_type w(1.0, 0.0);
+            for(size_t k = 0; k < length/2; k++)
+            {
+                complex_type a = data[start + k], b = data[start + k + length/2]*w;
+                data[start + k] = a + b;
+                data[start + k + length/2] = a - b;
+                w *= step;
+            }
+        }
+    }
+}
+
+// 2D transform of an n x n row major grid: rows, then columns through a
+// contiguous scratch copy. The inverse is scaled by 1/n^2.
+inline void FFT2D(std::vector<complex_type>& grid, size_t n, bool inverse)
+{
+    if(!IsPowerOfTwo(n) || grid.size() != n*n) throw std::runtime_error("FFT2D needs an n x n grid with n a power of two");
+
+    ParallelFor(0, n, [&](size_t begin, size_t end)
+    {
+        for(size_t y = begin; y < end; y++)
+            FFT(&grid[y*n], n, inverse);
+    });
+    ParallelFor(0, n, [&](size_t begin, size_t end)
+    {
+        std::vector<complex_type> column(n);
+        double scale = inverse ? 1.0/(double(n)*n) : 1.0;
+        for(size_t x = begin; x < end; x++)
+        {
+            for(size_t y = 0; y < n; y++)
+                column[y] = grid[y*n + x];
+            FFT(column.data(), n, inverse);
+            for(size_t y = 0; y < n; y++)
+                grid[y*n + x] = column[y]*scale;
+        }
+    });
+}
+
+#endif
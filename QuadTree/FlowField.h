@@ -0,0 +1,307 @@
+#ifndef FLOWFIELD_H
+#define FLOWFIELD_H
+
+#include "Boid.h"
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// windows.h defines min and max macros unless the build sets NOMINMAX (see
+// bench.cpp). The calls below are parenthesised to work either way.
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Flow file: "FLOW", then width, height and frame count as uint32, then every
+// frame as height rows of width (u, v) float pairs. Node (x, y) sits at
+// (-1 + 2x/width, -1 + 2y/height), values are world units per step.
+struct FlowFileHeader
+{
+    char magic[4];
+    uint32_t width, height, frames;
+};
+
+// Writes a flow file, calling func(frame, x, y, uv) for every node
+template<typename Func>
+void WriteFlowFile(const std::string& path, uint32_t width, uint32_t height, uint32_t frames, Func func)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if(!file) throw std::runtime_error("Could not create " + path);
+    FlowFileHeader header = {{'F', 'L', 'O', 'W'}, width, height, frames};
+    fwrite(&header, sizeof(header), 1, file);
+    std::vector<float> row(2*width);
+    for(uint32_t f = 0; f < frames; f++)
+        for(uint32_t y = 0; y < height; y++)
+        {
+            for(uint32_t x = 0; x < width; x++)
+            {
+                float uv[2];
+                func(f, x, y, uv);
+                row[2*x] = uv[0];
+                row[2*x + 1] = uv[1];
+            }
+            fwrite(row.data(), sizeof(float), row.size(), file);
+        }
+    fclose(file);
+}
+
+// Time varying flow field streamed from a memory mapped flow file. Only the
+// two frames being blended need to be resident: a background thread faults
+// in the frame after them while the current pair is sampled, and every frame
+// touched that falls outside the pair and the one after it is dropped from
+// the mapping, however far time jumps.
+class FlowField
+{
+public:
+    float coupling = 0.05f; // Fraction of the velocity difference to the flow applied per step
+
+    FlowField() {};
+    explicit FlowField(const std::string& path) { Open(path); }
+    FlowField(const FlowField&) = delete;
+    FlowField& operator=(const FlowField&) = delete;
+    ~FlowField() { Close(); }
+
+    void Open(const std::string& path)
+    {
+        Close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE) throw std::runtime_error("Could not open " + path);
+        LARGE_INTEGER file_size;
+        GetFileSizeEx(file, &file_size);
+        mapped_size = static_cast<size_t>(file_size.QuadPart);
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        data = mapping ? static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+#else
+        descriptor = open(path.c_str(), O_RDONLY);
+        if(descriptor < 0) throw std::runtime_error("Could not open " + path);
+        struct stat info;
+        fstat(descriptor, &info);
+        mapped_size = static_cast<size_t>(info.st_size);
+        void* address = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, descriptor, 0);
+        data = address == MAP_FAILED ? nullptr : static_cast<const char*>(address);
+#endif
+        if(!data)
+        {
+            Close();
+            throw std::runtime_error("Could not map " + path);
+        }
+
+        FlowFileHeader header;
+        if(mapped_size >= sizeof(header)) std::memcpy(&header, data, sizeof(header));
+        if(mapped_size < sizeof(header) || std::memcmp(header.magic, "FLOW", 4) != 0 || !header.width || !header.height || !header.frames ||
+           mapped_size < sizeof(header) + size_t(header.frames)*header.width*header.height*2*sizeof(float))
+        {
+            Close();
+            throw std::runtime_error(path + " is not a flow file");
+        }
+        width = header.width;
+        height = header.height;
+        frames = header.frames;
+
+        stop = false;
+        requested = prefetched = in_flight = frames;
+        prefetcher = std::thread([this] { Prefetch(); });
+    }
+
+    void Close()
+    {
+        if(prefetcher.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            wake.notify_one();
+            prefetcher.join();
+        }
+#ifdef _WIN32
+        if(data) UnmapViewOfFile(data);
+        if(mapping) CloseHandle(mapping);
+        if(file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if(data) munmap(const_cast<char*>(data), mapped_size);
+        if(descriptor >= 0) close(descriptor);
+        descriptor = -1;
+#endif
+        data = nullptr;
+        frames = 0;
+        current = ~size_t(0);
+        resident.clear();
+    }
+
+    bool IsOpen() const { return data != nullptr; }
+    size_t Frames() const { return frames; }
+
+    // Frames touched and not dropped since, at most the pair, the one after
+    // it and one still being prefetched
+    size_t ResidentFrames()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return resident.size();
+    }
+
+    // Steers every boid towards the flow at `time`, counted in frames and
+    // looping over the file. Frames are blended linearly in time.
+    template<typename Storage>
+    void Apply(BasicFlock<Storage>& flock, double time)
+    {
+        if(!data) return;
+        double wrapped = fmod(time, static_cast<double>(frames));
+        if(wrapped < 0) wrapped += frames;
+        size_t first = static_cast<size_t>(wrapped) % frames, second = (first + 1) % frames;
+        float blend = static_cast<float>(wrapped - floor(wrapped));
+        Advance(first);
+
+        const float* frame[2] = {Frame(first), Frame(second)};
+        ParallelFor(0, flock.size(), [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+            {
+                float flow[2][2];
+                Sample(frame[0], flock.GetLocation(0, i), flock.GetLocation(1, i), flock.periodic, flow[0]);
+                Sample(frame[1], flock.GetLocation(0, i), flock.GetLocation(1, i), flock.periodic, flow[1]);
+                for(size_t d = 0; d < 2; d++)
+                {
+                    float target = flow[0][d] + blend*(flow[1][d] - flow[0][d]);
+                    flock.acceleration[d][i] += coupling*(target - flock.GetVelocity(d, i));
+                }
+            }
+        });
+    }
+
+private:
+    const char* data = nullptr;
+    size_t mapped_size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int descriptor = -1;
+#endif
+    size_t width = 0, height = 0, frames = 0;
+    size_t current = ~size_t(0);
+
+    std::thread prefetcher;
+    std::mutex mutex;
+    std::condition_variable wake;
+    size_t requested = 0, prefetched = 0;
+    size_t in_flight = 0;           // Frame the prefetcher is faulting in, frames if none
+    std::vector<size_t> resident;   // Frames touched and not yet dropped
+    bool stop = false;
+
+    size_t FrameBytes() const { return width*height*2*sizeof(float); }
+    const float* Frame(size_t f) const { return reinterpret_cast<const float*>(data + sizeof(FlowFileHeader) + f*FrameBytes()); }
+
+    // Bilinear sample of one frame, wrapping on the torus or clamping at the edges
+    void Sample(const float* frame, float x, float y, bool periodic, float (&uv)[2]) const
+    {
+        float u = (x + 1.f)*0.5f*width, v = (y + 1.f)*0.5f*height;
+        long x0 = static_cast<long>(floorf(u)), y0 = static_cast<long>(floorf(v));
+        float fx = u - x0, fy = v - y0;
+        long w = static_cast<long>(width), h = static_cast<long>(height);
+        long x1 = x0 + 1, y1 = y0 + 1;
+        if(periodic)
+        {
+            x0 = (x0%w + w)%w; x1 = (x1%w + w)%w;
+            y0 = (y0%h + h)%h; y1 = (y1%h + h)%h;
+        }
+        else
+        {
+            x0 = (std::max)(0L, (std::min)(w - 1, x0)); x1 = (std::max)(0L, (std::min)(w - 1, x1));
+            y0 = (std::max)(0L, (std::min)(h - 1, y0)); y1 = (std::max)(0L, (std::min)(h - 1, y1));
+        }
+        const float* corner[4] = {frame + 2*(y0*w + x0), frame + 2*(y0*w + x1), frame + 2*(y1*w + x0), frame + 2*(y1*w + x1)};
+        for(size_t d = 0; d < 2; d++)
+        {
+            float bottom = corner[0][d] + fx*(corner[1][d] - corner[0][d]);
+            float top = corner[2][d] + fx*(corner[3][d] - corner[2][d]);
+            uv[d] = bottom + fy*(top - bottom);
+        }
+    }
+
+    // Called when the blended pair starts at `first`: drop every resident
+    // frame outside [first, first + 2] and ask for the one after the pair. A
+    // frame the prefetcher is still faulting in is dropped on a later call.
+    void Advance(size_t first)
+    {
+        if(first == current) return;
+        current = first;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t kept = 0;
+            for(size_t f: resident)
+            {
+                if((f + frames - first) % frames <= 2 || f == in_flight)
+                    resident[kept++] = f;
+                else
+                {
+                    Release(f);
+                    if(f == prefetched) prefetched = frames;
+                }
+            }
+            resident.resize(kept);
+            for(size_t f: {first, (first + 1) % frames, (first + 2) % frames})
+                if(std::find(resident.begin(), resident.end(), f) == resident.end()) resident.push_back(f);
+            requested = (first + 2) % frames;
+        }
+        wake.notify_one();
+    }
+
+    void Release(size_t f) const
+    {
+#ifndef _WIN32
+        // madvise wants page aligned ranges, so only drop the pages fully inside the frame
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t begin = sizeof(FlowFileHeader) + f*FrameBytes(), end = begin + FrameBytes();
+        begin = (begin + page - 1)/page*page;
+        end = end/page*page;
+        if(end > begin) madvise(const_cast<char*>(data) + begin, end - begin, MADV_DONTNEED);
+#else
+        (void)f;
+#endif
+    }
+
+    // Background thread: touch one byte per page so the frame's page faults
+    // happen here rather than in the update
+    void Prefetch()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true)
+        {
+            wake.wait(lock, [this] { return stop || requested != prefetched; });
+            if(stop) return;
+            size_t f = requested;
+            in_flight = f;
+            lock.unlock();
+
+            const char* begin = data + sizeof(FlowFileHeader) + f*FrameBytes();
+#ifndef _WIN32
+            size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            size_t offset = reinterpret_cast<uintptr_t>(begin)%page;
+            madvise(const_cast<char*>(begin) - offset, FrameBytes() + offset, MADV_WILLNEED);
+#else
+            size_t page = 4096;
+#endif
+            volatile char sink = 0;
+            for(size_t b = 0; b < FrameBytes(); b += page)
+                sink = sink + begin[b];
+
+            lock.lock();
+            prefetched = f;
+            in_flight = frames;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include "Parallel.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Uniform grid over [-1,1]^2 built with a counting sort. Boids of cell c are
+// sorted[cell_start[c] .. cell_start[c+1]). Works with anything exposing
+// size() and GetLocation(d, i).
+class UniformGrid
+{
+public:
+    size_t cells_per_side = 1;
+    std::vector<uint32_t> cell_start;
+    std::vector<uint32_t> sorted;
+
+    size_t CellCoordinate(float val) const
+    {
+        long cell = static_cast<long>((val + 1.f)*0.5f*cells_per_side);
+        return static_cast<size_t>(std::max(0L, std::min(cell, static_cast<long>(cells_per_side) - 1)));
+    }
+
+    // Cells no smaller than min_cell_size, so a 3x3 stencil covers that radius
+    template<typename Source>
+    void Build(const Source& source, float min_cell_size)
+    {
+        BuildCells(source, static_cast<size_t>(2.f/min_cell_size));
+    }
+
+    // Same with the number of cells along a side given directly
+    template<typename Source>
+    void BuildCells(const Source& source, size_t side)
+    {
+        cells_per_side = std::max<size_t>(1, side);
+        size_t count = source.size();
+        size_t cells = cells_per_side*cells_per_side;
+
+        cell_of.resize(count);
+        ParallelFor(0, count, [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+                cell_of[i] = static_cast<uint32_t>(CellCoordinate(source.GetLocation(1, i))*cells_per_side + CellCoordinate(source.GetLocation(0, i)));
+        });
+
+        cell_start.assign(cells + 1, 0);
+        for(uint32_t cell: cell_of)
+            cell_start[cell + 1]++;
+        for(size_t c = 0; c < cells; c++)
+            cell_start[c + 1] += cell_start[c];
+
+        sorted.resize(count);
+        cursor.assign(cell_start.begin(), cell_start.end() - 1);
+        for(size_t i = 0; i < count; i++)
+            sorted[cursor[cell_of[i]]++] = static_cast<uint32_t>(i);
+    }
+
+    // Calls func(cell) for the 3x3 block around (cx, cy), wrapping on the torus.
+    // Grids under 3 cells wide would visit a cell twice, so those visit each once.
+    template<typename Func>
+    void ForEachNeighborCell(size_t cx, size_t cy, bool periodic, Func func) const
+    {
+        long n = static_cast<long>(cells_per_side);
+        long first = n < 3 ? 0 : -1, last = n < 3 ? n - 1 : 1;
+        for(long dy = first; dy <= last; dy++)
+        {
+            long y = n < 3 ? dy : static_cast<long>(cy) + dy;
+            if(y < 0 || y >= n)
+            {
+                if(!periodic) continue;
+                y = (y + n) % n;
+            }
+            for(long dx = first; dx <= last; dx++)
+            {
+                long x = n < 3 ? dx : static_cast<long>(cx) + dx;
+                if(x < 0 || x >= n)
+                {
+                    if(!periodic) continue;
+                    x = (x + n) % n;
+                }
+                func(static_cast<size_t>(y*n + x));
+            }
+        }
+    }
+
+private:
+    std::vector<uint32_t> cell_of;
+    std::vector<uint32_t> cursor;
+};
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef MEANFIELD_H
+#define MEANFIELD_H
+
+#include "Boid.h"
+#include "Grid.h"
+
+// Separation from every boid within radius of the primary (at p), through a
+// grid built with cells no smaller than radius
+template<typename Storage>
+void AddShortRangeSeperation(const BasicFlock<Storage>& flock, const UniformGrid& grid, size_t primary, const float (&p)[2], float radius, typename BasicFlock<Storage>::NeighborSums& sums)
+{
+    float radius_squared = radius*radius;
+    grid.ForEachNeighborCell(grid.CellCoordinate(p[0]), grid.CellCoordinate(p[1]), flock.periodic, [&](size_t cell)
+    {
+        for(uint32_t c = grid.cell_start[cell]; c < grid.cell_start[cell + 1]; c++)
+        {
+            uint32_t j = grid.sorted[c];
+            if(j == primary) continue;
+            float offset[2];
+            for(size_t d = 0; d < 2; d++)
+            {
+                offset[d] = p[d] - flock.GetLocation(d, j);
+                if(flock.periodic) offset[d] = MinimumImage(offset[d]);
+            }
+            float dist = offset[0]*offset[0] + offset[1]*offset[1];
+            if(dist <= radius_squared) BasicFlock<Storage>::AddSeperation(sums, offset, dist);
+        }
+    });
+}
+
+// Mean-field grid update. Boids are binned once into a fine grid and a 2D
+// summed-area table of count, location and velocity is built, so the
+// neighbourhood averages for cohesion and alignment come from an O(1)
+// rectangle query (the square of side 2*radius around each boid) instead of
+// a pair loop. Separation falls off fast, so it stays a true pair loop over
+// a much shorter radius.
+class MeanFieldGrid
+{
+public:
+    static const size_t channels = 5; // count, x, y, vx, vy
+
+    size_t cells_per_radius = 8;
+    float seperation_fraction = 0.25f; // Separation radius relative to InteractionRadius()
+
+    size_t cells_per_side = 1;
+    // (cells_per_side+1)^2 prefix sums, row and column 0 are zero
+    std::vector<double> table;
+
+    template<typename Storage>
+    void Build(const BasicFlock<Storage>& flock)
+    {
+        float radius = flock.InteractionRadius();
+        cells_per_side = std::max<size_t>(1, static_cast<size_t>(2.f*cells_per_radius/radius));
+        size_t n = cells_per_side, stride = n + 1;
+        table.assign(stride*stride*channels, 0.0);
+
+        // Binned with a private grid per worker, then prefix summed along x,
+        // one row per task
+        size_t count = flock.size();
+        bins.Run(count, n*n*channels, cells, [&](double* cell_sums, size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+            {
+                float x = flock.GetLocation(0, i), y = flock.GetLocation(1, i);
+                double* cell = &cell_sums[(CellCoordinate(y)*n + CellCoordinate(x))*channels];
+                cell[0] += 1.0;
+                cell[1] += x;
+                cell[2] += y;
+                cell[3] += flock.GetVelocity(0, i);
+                cell[4] += flock.GetVelocity(1, i);
+            }
+        });
+        ParallelFor(0, n, [&](size_t begin, size_t end)
+        {
+            for(size_t y = begin; y < end; y++)
+            {
+                double running[channels] = {};
+                for(size_t x = 0; x < n; x++)
+                    for(size_t c = 0; c < channels; c++)
+                    {
+                        running[c] += cells[(y*n + x)*channels + c];
+                        table[((y + 1)*stride + x + 1)*channels + c] = running[c];
+                    }
+            }
+        });
+        // Then along y, one column per task
+        ParallelFor(1, stride, [&](size_t begin, size_t end)
+        {
+            for(size_t x = begin; x < end; x++)
+                for(size_t y = 2; y < stride; y++)
+                    for(size_t c = 0; c < channels; c++)
+                        table[(y*stride + x)*channels + c] += table[((y - 1)*stride + x)*channels + c];
+        });
+
+        seperation_radius = radius*seperation_fraction;
+        seperation_grid.Build(flock, seperation_radius);
+    }
+
+    // Accumulates the flocking rules for every boid. The tables hold the built
+    // in rules' sums, so a rule flock is refused.
+    template<typename FlockType>
+    void Update(FlockType& flock) const
+    {
+        static_assert(FlockType::builtin_rules, "MeanFieldGrid only computes the built in rules");
+        ParallelFor(0, flock.size(), [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+                UpdateBoid(flock, i);
+        });
+    }
+
+private:
+    ScatterSums<double> bins;
+    std::vector<double> cells;
+    UniformGrid seperation_grid;
+    float seperation_radius = 0.f;
+
+    struct Span
+    {
+        long first, last;   // Inclusive cell range inside the grid
+        float image;        // Added to coordinates of boids in the span
+    };
+
+    size_t CellCoordinate(float val) const
+    {
+        long cell = static_cast<long>((val + 1.f)*0.5f*cells_per_side);
+        return static_cast<size_t>(std::max(0L, std::min(cell, static_cast<long>(cells_per_side) - 1)));
+    }
+
+    // Cells covering [low, high], split where the range crosses the wrap seam
+    size_t Spans(float low, float high, bool periodic, Span (&spans)[2]) const
+    {
+        long n = static_cast<long>(cells_per_side);
+        long first = static_cast<long>(floorf((low + 1.f)*0.5f*n));
+        long last = static_cast<long>(floorf((high + 1.f)*0.5f*n));
+        if(!periodic || last - first + 1 >= n)
+        {
+            spans[0] = Span{std::max(0L, first), std::min(n - 1, last), 0.f};
+            return 1;
+        }
+        if(first < 0)
+        {
+            spans[0] = Span{first + n, n - 1, -2.f};
+            spans[1] = Span{0, std::min(n - 1, last), 0.f};
+            return 2;
+        }
+        if(last >= n)
+        {
+            spans[0] = Span{first, n - 1, 0.f};
+            spans[1] = Span{0, last - n, 2.f};
+            return 2;
+        }
+        spans[0] = Span{first, last, 0.f};
+        return 1;
+    }
+
+    void RectangleSum(const Span& x, const Span& y, double (&sum)[channels]) const
+    {
+        size_t stride = cells_per_side + 1;
+        size_t x0 = x.first, x1 = x.last + 1, y0 = y.first, y1 = y.last + 1;
+        for(size_t c = 0; c < channels; c++)
+            sum[c] = table[(y1*stride + x1)*channels + c] - table[(y0*stride + x1)*channels + c]
+                   - table[(y1*stride + x0)*channels + c] + table[(y0*stride + x0)*channels + c];
+    }
+
+    template<typename Storage>
+    void UpdateBoid(BasicFlock<Storage>& flock, size_t primary) const
+    {
+        typedef BasicFlock<Storage> FlockType;
+        const bool periodic = flock.periodic;
+        float radius = flock.InteractionRadius();
+        float p[2] = {flock.GetLocation(0, primary), flock.GetLocation(1, primary)};
+        float v[2] = {flock.GetVelocity(0, primary), flock.GetVelocity(1, primary)};
+
+        Span x_spans[2], y_spans[2];
+        size_t x_count = Spans(p[0] - radius, p[0] + radius, periodic, x_spans);
+        size_t y_count = Spans(p[1] - radius, p[1] + radius, periodic, y_spans);
+
+        double total[channels] = {};
+        for(size_t a = 0; a < y_count; a++)
+            for(size_t b = 0; b < x_count; b++)
+            {
+                double sum[channels];
+                RectangleSum(x_spans[b], y_spans[a], sum);
+                total[0] += sum[0];
+                total[1] += sum[1] + sum[0]*x_spans[b].image;
+                total[2] += sum[2] + sum[0]*y_spans[a].image;
+                total[3] += sum[3];
+                total[4] += sum[4];
+            }
+
+        // The primary sits in its own rectangle
+        typename FlockType::NeighborSums sums;
+        sums.count = static_cast<float>(total[0] - 1.0);
+        for(size_t d = 0; d < 2; d++)
+        {
+            sums.location[d] = static_cast<float>(total[1 + d] - p[d]);
+            sums.velocity[d] = static_cast<float>(total[3 + d] - v[d]);
+        }
+        if(sums.count < 0.5f) return;
+
+        AddShortRangeSeperation(flock, seperation_grid, primary, p, seperation_radius, sums);
+        flock.Finish(primary, sums);
+    }
+};
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef NEIGHBORLIST_H
+#define NEIGHBORLIST_H
+
+#include "Boid.h"
+#include "Grid.h"
+
+// Verlet neighbour lists. Every boid keeps the boids within
+// InteractionRadius() + skin, stored CSR style: the neighbours of boid i are
+// neighbors[offsets[i] .. offsets[i+1]). The lists stay valid until some boid
+// has moved more than skin/2 since the build, so they are reused for as many
+// steps as that takes instead of rebuilding the index every step.
+class NeighborList
+{
+public:
+    float skin;
+    std::vector<size_t> offsets;
+    std::vector<uint32_t> neighbors;
+    size_t builds = 0;
+
+    explicit NeighborList(float skin) : skin(skin) {};
+
+    template<typename Storage>
+    bool NeedsRebuild(const BasicFlock<Storage>& flock) const
+    {
+        if(reference_location[0].size() != flock.size()) return true;
+
+        float limit = 0.25f*skin*skin;
+        float max_moved = ParallelReduce(0, flock.size(), 0.f, [&](size_t begin, size_t end)
+        {
+            float moved = 0.f;
+            for(size_t i = begin; i < end; i++)
+            {
+                float squared = 0.f;
+                for(size_t d = 0; d < BasicFlock<Storage>::dimension; d++)
+                {
+                    float delta = flock.GetLocation(d, i) - reference_location[d][i];
+                    if(flock.periodic) delta = MinimumImage(delta);
+                    squared += delta*delta;
+                }
+                moved = std::max(moved, squared);
+            }
+            return moved;
+        }, [](float a, float b) { return std::max(a, b); });
+
+        return max_moved > limit;
+    }
+
+    template<typename Storage>
+    void Build(const BasicFlock<Storage>& flock)
+    {
+        const size_t dimension = BasicFlock<Storage>::dimension;
+        float radius = flock.InteractionRadius() + skin;
+        float radius_squared = radius*radius;
+        size_t count = flock.size();
+        grid.Build(flock, radius);
+
+        for(size_t d = 0; d < dimension; d++)
+        {
+            reference_location[d].resize(count);
+            for(size_t i = 0; i < count; i++)
+                reference_location[d][i] = flock.GetLocation(d, i);
+        }
+
+        // Two passes over the same stencil, count then fill, so every boid
+        // writes its own slice of the CSR arrays without locking
+        auto visit = [&](size_t i, auto&& emit)
+        {
+            float x = reference_location[0][i], y = reference_location[1][i];
+            grid.ForEachNeighborCell(grid.CellCoordinate(x), grid.CellCoordinate(y), flock.periodic, [&](size_t cell)
+            {
+                for(uint32_t c = grid.cell_start[cell]; c < grid.cell_start[cell + 1]; c++)
+                {
+                    uint32_t j = grid.sorted[c];
+                    if(j == i) continue;
+                    float dx = x - reference_location[0][j], dy = y - reference_location[1][j];
+                    if(flock.periodic)
+                    {
+                        dx = MinimumImage(dx);
+                        dy = MinimumImage(dy);
+                    }
+                    if(dx*dx + dy*dy <= radius_squared) emit(j);
+                }
+            });
+        };
+
+        offsets.assign(count + 1, 0);
+        ParallelFor(0, count, [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+            {
+                size_t found = 0;
+                visit(i, [&](uint32_t) { found++; });
+                offsets[i + 1] = found;
+            }
+        });
+        for(size_t i = 0; i < count; i++)
+            offsets[i + 1] += offsets[i];
+
+        neighbors.resize(offsets[count]);
+        ParallelFor(0, count, [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+            {
+                size_t next = offsets[i];
+                visit(i, [&](uint32_t j) { neighbors[next++] = j; });
+            }
+        });
+        builds++;
+    }
+
+    // Accumulates the flock's rules for every boid from its list. Templated on
+    // the flock type so a rule flock's own Update is the one called.
+    template<typename FlockType>
+    void Update(FlockType& flock) const
+    {
+        ParallelFor(0, flock.size(), [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+                flock.Update(i, neighbors.begin() + offsets[i], neighbors.begin() + offsets[i + 1]);
+        });
+    }
+
+    // Rebuilds when stale, then applies the rules
+    template<typename FlockType>
+    void Step(FlockType& flock)
+    {
+        if(NeedsRebuild(flock)) Build(flock);
+        Update(flock);
+    }
+
+private:
+    UniformGrid grid;
+    std::vector<float> reference_location[2];
+};
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include "Boid.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Linux places a page on the NUMA node of the thread that first writes it.
+// The flock arrays are written first by the serial Resize in a plain
+// std::vector, so every page lands on the main thread's node and the other
+// sockets read the whole flock remotely. The pieces here let each worker
+// touch the pages of the boids it owns instead:
+//   PlacedAllocator - leaves new elements unwritten and maps large arrays
+//                     with huge pages
+//   PinWorkers()    - keeps chunk w of every ParallelFor on the same core
+//   SortSpatially   - makes each chunk a spatial region, then rewrites the
+//                     arrays so every chunk's pages are touched by its worker
+
+enum class HugePageMode
+{
+    None,           // Plain 4 KiB pages
+    Transparent,    // madvise(MADV_HUGEPAGE), the kernel backs what it can
+    Explicit        // MAP_HUGETLB from the reserved pool, falls back to plain pages
+};
+
+inline HugePageMode& HugePages()
+{
+    static HugePageMode mode = HugePageMode::Transparent;
+    return mode;
+}
+
+// Allocator for the flock arrays. Arrays of at least huge_page_size bytes are
+// mapped directly and rounded up to whole huge pages; nothing is written, so
+// the first thread to store into a page decides its node. Elements are
+// default initialised for the same reason, which for the arithmetic element
+// types means not written at all.
+template<typename T>
+class PlacedAllocator
+{
+public:
+    typedef T value_type;
+    static const size_t huge_page_size = size_t(2) << 20;
+
+    PlacedAllocator() {}
+    template<typename U>
+    PlacedAllocator(const PlacedAllocator<U>&) {}
+
+    template<typename U>
+    struct rebind { typedef PlacedAllocator<U> other; };
+
+    T* allocate(size_t n)
+    {
+        size_t bytes = n*sizeof(T);
+#ifndef _WIN32
+        if(bytes >= huge_page_size)
+        {
+            bytes = MappedBytes(n);
+            void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+            if(HugePages() == HugePageMode::Explicit)
+                p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+            if(p == MAP_FAILED)
+            {
+                p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if(p == MAP_FAILED) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+                if(HugePages() != HugePageMode::None) madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+            }
+            return static_cast<T*>(p);
+        }
+#endif
+        void* p = malloc(std::max<size_t>(1, bytes));
+        if(!p) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+#ifndef _WIN32
+        if(n*sizeof(T) >= huge_page_size)
+        {
+            munmap(p, MappedBytes(n));
+            return;
+        }
+#endif
+        free(p);
+    }
+
+    template<typename U, typename... Args>
+    void construct(U* p, Args&&... args) { ::new(static_cast<void*>(p)) U(std::forward<Args>(args)...); }
+
+    // No arguments is what resize() asks for, leave the page untouched
+    template<typename U>
+    void construct(U* p) { ::new(static_cast<void*>(p)) U; }
+
+private:
+    static size_t MappedBytes(size_t n)
+    {
+        return (n*sizeof(T) + huge_page_size - 1)/huge_page_size*huge_page_size;
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const PlacedAllocator<T>&, const PlacedAllocator<U>&) { return true; }
+template<typename T, typename U>
+bool operator!=(const PlacedAllocator<T>&, const PlacedAllocator<U>&) { return false; }
+
+// fp32 flock whose arrays are placed by the threads that first write them
+struct PlacedStorage : FloatStorage
+{
+    template<typename T> using allocator = PlacedAllocator<T>;
+};
+
+typedef BasicFlock<PlacedStorage> PlacedFlock;
+
+// Node of the page holding address, -1 if unknown or not resident
+inline int NodeOfAddress(const void* address)
+{
+#if defined(__linux__) && defined(SYS_move_pages)
+    void* page = const_cast<void*>(address);
+    int status = -1;
+    if(syscall(SYS_move_pages, 0, 1UL, &page, nullptr, &status, 0) != 0) return -1;
+    return status;
+#else
+    (void)address;
+    return -1;
+#endif
+}
+
+// Node the calling thread is running on, 0 where that cannot be asked
+inline int CurrentNode()
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu = 0, node = 0;
+    if(syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) return static_cast<int>(node);
+#endif
+    return 0;
+}
+
+// Interleaves the bits of the two quantised coordinates, nearby boids get
+// nearby keys
+inline uint32_t MortonKey(float x, float y)
+{
+    auto spread = [](float val)
+    {
+        uint32_t v = static_cast<uint32_t>(std::min(65535.f, std::max(0.f, (val + 1.f)*32768.f)));
+        v = (v | (v << 8)) & 0x00ff00ffu;
+        v = (v | (v << 4)) & 0x0f0f0f0fu;
+        v = (v | (v << 2)) & 0x33333333u;
+        v = (v | (v << 1)) & 0x55555555u;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+// Reorders the boids along a Morton curve, so every ParallelFor chunk over the
+// flock is one compact region of the plane and a chunk's neighbours mostly
+// live in the same chunk. The arrays are rebuilt into fresh allocations
+// inside a ParallelFor, so with PlacedStorage (and PinWorkers() for a stable
+// chunk to core mapping) each chunk's pages are first touched by its worker.
+// Any index built on the old order is stale afterwards.
+template<typename Storage, size_t Dimension>
+void SortSpatially(BasicFlock<Storage, Dimension>& flock)
+{
+    size_t count = flock.size();
+    std::vector<uint32_t> keys(count);
+    std::vector<uint32_t> order(count);
+    ParallelFor(0, count, [&](size_t begin, size_t end)
+    {
+        for(size_t i = begin; i < end; i++)
+        {
+            keys[i] = MortonKey(flock.GetLocation(0, i), flock.GetLocation(1, i));
+            order[i] = static_cast<uint32_t>(i);
+        }
+    });
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b] || (keys[a] == keys[b] && a < b); });
+
+    auto permute = [&](auto& array)
+    {
+        typename std::remove_reference<decltype(array)>::type sorted;
+        sorted.resize(count);
+        ParallelFor(0, count, [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+                sorted[i] = array[order[i]];
+        });
+        array.swap(sorted);
+    };
+    for(size_t d = 0; d < Dimension; d++)
+    {
+        permute(flock.location[d]);
+        permute(flock.velocity[d]);
+        permute(flock.acceleration[d]);
+    }
+}
+
+#endif
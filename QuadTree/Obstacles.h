@@ -0,0 +1,202 @@
+#ifndef OBSTACLES_H
+#define OBSTACLES_H
+
+#include "Boid.h"
+#include <vector>
+
+struct CircleObstacle
+{
+    float x, y, radius;
+};
+
+// Simple polygon, vertices in order (either winding)
+struct PolygonObstacle
+{
+    std::vector<float> x, y;
+};
+
+// Static obstacles baked into a signed distance field over [-1,1]^2, negative
+// inside. The field and its gradient live on (cells_per_side+1)^2 nodes, so a
+// boid's lookup is one bilinear sample whatever the number of obstacles.
+class ObstacleField
+{
+public:
+    size_t cells_per_side = 256;
+    float range = 0.05f;        // Boids closer than this to a surface steer away
+    float strength = 0.002f;    // Avoidance acceleration at the surface
+
+    std::vector<CircleObstacle> circles;
+    std::vector<PolygonObstacle> polygons;
+
+    bool empty() const { return circles.empty() && polygons.empty(); }
+
+    // Signed distance from (x, y) to the union of all obstacles, brute force
+    float Distance(float x, float y, bool periodic) const
+    {
+        float retval = 4.f;
+        for(auto& circle: circles)
+        {
+            float dx = x - circle.x, dy = y - circle.y;
+            if(periodic)
+            {
+                dx = MinimumImage(dx);
+                dy = MinimumImage(dy);
+            }
+            retval = std::min(retval, sqrtf(dx*dx + dy*dy) - circle.radius);
+        }
+        for(auto& polygon: polygons)
+            retval = std::min(retval, PolygonDistance(polygon, x, y, periodic));
+        return retval;
+    }
+
+    // Samples every node, then takes the gradient by central differences
+    void Bake(bool periodic)
+    {
+        size_t n = cells_per_side, stride = n + 1;
+        float spacing = 2.f/n;
+        distance.resize(stride*stride);
+        ParallelFor(0, stride, [&](size_t begin, size_t end)
+        {
+            for(size_t y = begin; y < end; y++)
+                for(size_t x = 0; x < stride; x++)
+                    distance[y*stride + x] = Distance(-1.f + x*spacing, -1.f + y*spacing, periodic);
+        });
+
+        // Node n is node 0 again on the torus, so step over it when wrapping
+        auto neighbor = [&](size_t i, long step)
+        {
+            long j = static_cast<long>(i) + step;
+            if(j >= 0 && j <= static_cast<long>(n)) return static_cast<size_t>(j);
+            if(!periodic) return i;
+            return static_cast<size_t>(j < 0 ? j + static_cast<long>(n) : j - static_cast<long>(n));
+        };
+        gradient[0].resize(stride*stride);
+        gradient[1].resize(stride*stride);
+        ParallelFor(0, stride, [&](size_t begin, size_t end)
+        {
+            for(size_t y = begin; y < end; y++)
+                for(size_t x = 0; x < stride; x++)
+                {
+                    size_t x0 = neighbor(x, -1), x1 = neighbor(x, 1), y0 = neighbor(y, -1), y1 = neighbor(y, 1);
+                    // One sided at the edges of a bounded field
+                    float dx = (x0 != x && x1 != x ? 2.f : 1.f)*spacing;
+                    float dy = (y0 != y && y1 != y ? 2.f : 1.f)*spacing;
+                    gradient[0][y*stride + x] = (distance[y*stride + x1] - distance[y*stride + x0])/dx;
+                    gradient[1][y*stride + x] = (distance[y1*stride + x] - distance[y0*stride + x])/dy;
+                }
+        });
+    }
+
+    // Bilinear lookup of the baked distance
+    float Sample(float x, float y) const
+    {
+        size_t n = cells_per_side, stride = n + 1;
+        float scale = n*0.5f, limit = static_cast<float>(n) - 1e-3f;
+        float u = std::max(0.f, std::min(limit, (x + 1.f)*scale)), v = std::max(0.f, std::min(limit, (y + 1.f)*scale));
+        size_t cx = static_cast<size_t>(u), cy = static_cast<size_t>(v);
+        float fx = u - cx, fy = v - cy;
+        const float* corner = &distance[cy*stride + cx];
+        float bottom = corner[0] + fx*(corner[1] - corner[0]);
+        float top = corner[stride] + fx*(corner[stride + 1] - corner[stride]);
+        return bottom + fy*(top - bottom);
+    }
+
+    // Adds the avoidance acceleration to every boid. Run it before the
+    // neighbour update so Finish() caps it together with separation.
+    template<typename Storage>
+    void Apply(BasicFlock<Storage>& flock) const
+    {
+        if(distance.empty()) return;
+        ParallelFor(0, flock.size(), [&](size_t begin, size_t end)
+        {
+            for(size_t first = begin; first < end; first += batch)
+                ApplyBatch(flock, first, std::min(end, first + batch));
+        });
+    }
+
+private:
+    static const size_t batch = 8;
+
+    std::vector<float> distance;
+    std::vector<float> gradient[2];
+
+    static float SegmentDistanceSquared(float px, float py, float ax, float ay, float bx, float by)
+    {
+        float ex = bx - ax, ey = by - ay;
+        float length = ex*ex + ey*ey;
+        float t = length > 0.f ? std::max(0.f, std::min(1.f, ((px - ax)*ex + (py - ay)*ey)/length)) : 0.f;
+        float dx = px - ax - t*ex, dy = py - ay - t*ey;
+        return dx*dx + dy*dy;
+    }
+
+    // Works in the frame of the first vertex so a polygon may straddle the seam
+    static float PolygonDistance(const PolygonObstacle& polygon, float x, float y, bool periodic)
+    {
+        size_t count = polygon.x.size();
+        if(count < 2) return 4.f;
+        float px = x - polygon.x[0], py = y - polygon.y[0];
+        if(periodic)
+        {
+            px = MinimumImage(px);
+            py = MinimumImage(py);
+        }
+
+        float closest = 16.f;
+        bool inside = false;
+        for(size_t i = 0, j = count - 1; i < count; j = i++)
+        {
+            float ax = polygon.x[j] - polygon.x[0], ay = polygon.y[j] - polygon.y[0];
+            float bx = polygon.x[i] - polygon.x[0], by = polygon.y[i] - polygon.y[0];
+            closest = std::min(closest, SegmentDistanceSquared(px, py, ax, ay, bx, by));
+            if((by > py) != (ay > py) && px < (ax - bx)*(py - by)/(ay - by) + bx) inside = !inside;
+        }
+        return inside ? -sqrtf(closest) : sqrtf(closest);
+    }
+
+    // Fixed width batches with the gather split from the arithmetic, so the
+    // compiler can keep the weights and the response in vector registers
+    template<typename Storage>
+    void ApplyBatch(BasicFlock<Storage>& flock, size_t first, size_t last) const
+    {
+        size_t n = cells_per_side, stride = n + 1, count = last - first;
+        float scale = n*0.5f, limit = static_cast<float>(n) - 1e-3f;
+        float fx[batch] = {}, fy[batch] = {};
+        size_t corner[batch] = {};
+        for(size_t k = 0; k < count; k++)
+        {
+            float u = std::max(0.f, std::min(limit, (flock.GetLocation(0, first + k) + 1.f)*scale));
+            float v = std::max(0.f, std::min(limit, (flock.GetLocation(1, first + k) + 1.f)*scale));
+            size_t x = static_cast<size_t>(u), y = static_cast<size_t>(v);
+            fx[k] = u - x;
+            fy[k] = v - y;
+            corner[k] = y*stride + x;
+        }
+
+        float field[3][4][batch] = {};
+        const std::vector<float>* channels[3] = {&distance, &gradient[0], &gradient[1]};
+        const size_t offsets[4] = {0, 1, stride, stride + 1};
+        for(size_t c = 0; c < 3; c++)
+            for(size_t o = 0; o < 4; o++)
+                for(size_t k = 0; k < count; k++)
+                    field[c][o][k] = (*channels[c])[corner[k] + offsets[o]];
+
+        float sample[3][batch];
+        for(size_t c = 0; c < 3; c++)
+            for(size_t k = 0; k < batch; k++)
+            {
+                float bottom = field[c][0][k] + fx[k]*(field[c][1][k] - field[c][0][k]);
+                float top = field[c][2][k] + fx[k]*(field[c][3][k] - field[c][2][k]);
+                sample[c][k] = bottom + fy[k]*(top - bottom);
+            }
+
+        float push[batch];
+        for(size_t k = 0; k < batch; k++)
+            push[k] = sample[0][k] < range ? strength*(range - sample[0][k])/range : 0.f;
+
+        for(size_t k = 0; k < count; k++)
+            for(size_t d = 0; d < 2; d++)
+                flock.acceleration[d][first + k] += push[k]*sample[1 + d][k];
+    }
+};
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+inline size_t WorkerCount()
+{
+    size_t count = std::thread::hardware_concurrency();
+    return count ? count : 1;
+}
+
+// When set, the thread running chunk w of a ParallelFor is pinned to the w-th
+// CPU the process may use. Chunks of the same range then always run on the
+// same core, so memory a chunk touched first stays on that core's node. The
+// calling thread gets its own affinity back once its chunk is done.
+inline bool& PinWorkers()
+{
+    static bool pin = false;
+    return pin;
+}
+
+// Pins the calling thread to the slot-th allowed CPU. Returns false where
+// pinning is not supported.
+inline bool PinCurrentThread(size_t slot)
+{
+#ifdef __linux__
+    static const std::vector<int> allowed = []
+    {
+        std::vector<int> retval;
+        cpu_set_t set;
+        if(sched_getaffinity(0, sizeof(set), &set) == 0)
+            for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                if(CPU_ISSET(cpu, &set)) retval.push_back(cpu);
+        return retval;
+    }();
+    if(allowed.empty()) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(allowed[slot%allowed.size()], &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)slot;
+    return false;
+#endif
+}
+
+// Saves the calling thread's affinity mask and puts it back when destroyed
+class SavedAffinity
+{
+public:
+#ifdef __linux__
+    SavedAffinity() : saved(pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0) {}
+    ~SavedAffinity() { if(saved) pthread_setaffinity_np(pthread_self(), sizeof(set), &set); }
+#else
+    SavedAffinity() {}
+#endif
+    SavedAffinity(const SavedAffinity&) = delete;
+    SavedAffinity& operator=(const SavedAffinity&) = delete;
+
+private:
+#ifdef __linux__
+    cpu_set_t set;
+    bool saved;
+#endif
+};
+
+// True on a thread currently running a ParallelFor chunk. Nested calls from
+// there run inline, so a task that is itself one of many (an ensemble run,
+// say) does not fan out again.
+inline bool& InsideParallelFor()
+{
+    thread_local bool inside = false;
+    return inside;
+}
+
+// Splits [begin, end) into one contiguous chunk per worker and calls
+// func(chunk_begin, chunk_end) on each. The calling thread takes the last chunk.
+template<typename Func>
+void ParallelFor(size_t begin, size_t end, Func func, size_t workers = WorkerCount())
+{
+    if(end <= begin) return;
+    workers = std::max<size_t>(1, std::min(workers, end - begin));
+    if(workers == 1 || InsideParallelFor())
+    {
+        func(begin, end);
+        return;
+    }
+
+    size_t chunk = (end - begin + workers - 1)/workers;
+    bool pin = PinWorkers();
+    auto task = [&func, begin, chunk, pin](size_t chunk_begin, size_t chunk_end)
+    {
+        if(pin) PinCurrentThread((chunk_begin - begin)/chunk);
+        bool& inside = InsideParallelFor();
+        bool was_inside = inside;
+        inside = true;
+        func(chunk_begin, chunk_end);
+        inside = was_inside;
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(workers - 1);
+    for(size_t w = 0; w + 1 < workers; w++)
+    {
+        size_t chunk_begin = begin + w*chunk;
+        size_t chunk_end = std::min(end, chunk_begin + chunk);
+        if(chunk_begin >= chunk_end) break;
+        threads.emplace_back(task, chunk_begin, chunk_end);
+    }
+
+    // The caller takes the last chunk and its CPU, then gets its own mask
+    // back, as it may be a thread (the render loop, say) that must not stay
+    // stuck on one core
+    size_t last_begin = begin + threads.size()*chunk;
+    if(last_begin < end)
+    {
+        if(pin)
+        {
+            SavedAffinity affinity;
+            task(last_begin, end);
+        }
+        else task(last_begin, end);
+    }
+
+    for(auto& thread: threads)
+        thread.join();
+}
+
+// Maps every chunk of [begin, end) to a partial result with func(chunk_begin,
+// chunk_end) and folds the partials in chunk order with combine
+template<typename T, typename Func, typename Combine>
+T ParallelReduce(size_t begin, size_t end, T init, Func func, Combine combine, size_t workers = WorkerCount())
+{
+    if(end <= begin) return init;
+    workers = std::max<size_t>(1, std::min(workers, end - begin));
+    size_t chunk = (end - begin + workers - 1)/workers;
+    std::vector<T> partial(workers, init);
+    ParallelFor(0, workers, [&](size_t first, size_t last)
+    {
+        for(size_t w = first; w < last; w++)
+        {
+            size_t chunk_begin = begin + w*chunk;
+            size_t chunk_end = std::min(end, chunk_begin + chunk);
+            if(chunk_begin < chunk_end) partial[w] = func(chunk_begin, chunk_end);
+        }
+    }, workers);
+
+    T retval = init;
+    for(auto& elm: partial)
+        retval = combine(retval, elm);
+    return retval;
+}
+
+// Parallel scatter-add into an array of accumulators, a grid of bins say.
+// Items are cut into one contiguous run per worker and each run is added into
+// a private copy of the array, then the copies are summed into the result
+// cell-parallel, so no atomics are needed. The first worker adds straight
+// into the result. The other copies cost a whole array each, so together
+// they are capped at max_bytes: a large array gets fewer workers, down to one
+// adding straight into the result. The copies are kept between calls.
+template<typename T>
+class ScatterSums
+{
+public:
+    size_t max_bytes = size_t(64) << 20;
+
+    // scatter(cells, item_begin, item_end) adds the items in the range into
+    // cells, an array of `size`
+    template<typename Scatter>
+    void Run(size_t items, size_t size, std::vector<T>& result, Scatter scatter)
+    {
+        result.assign(size, T());
+        size_t copies = max_bytes/std::max<size_t>(1, size*sizeof(T));
+        size_t workers = std::max<size_t>(1, std::min(std::min(WorkerCount(), items), copies + 1));
+        size_t per_worker = (items + workers - 1)/workers;
+        partial.resize(workers - 1);
+        ParallelFor(0, workers, [&](size_t first, size_t last)
+        {
+            for(size_t w = first; w < last; w++)
+            {
+                T* cells = result.data();
+                if(w > 0)
+                {
+                    partial[w - 1].assign(size, T());
+                    cells = partial[w - 1].data();
+                }
+                size_t item_begin = std::min(items, w*per_worker);
+                size_t item_end = std::min(items, item_begin + per_worker);
+                if(item_begin < item_end) scatter(cells, item_begin, item_end);
+            }
+        }, workers);
+
+        if(partial.empty()) return;
+        ParallelFor(0, size, [&](size_t begin, size_t end)
+        {
+            for(size_t c = begin; c < end; c++)
+                for(auto& elm: partial)
+                    result[c] += elm[c];
+        });
+    }
+
+private:
+    std::vector<std::vector<T> > partial;
+};
+
+#endif
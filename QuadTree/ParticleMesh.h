@@ -0,0 +1,203 @@
+#ifndef PARTICLEMESH_H
+#define PARTICLEMESH_H
+
+#include "Boid.h"
+#include "FFT.h"
+#include "MeanField.h"
+
+// Particle-mesh update for large interaction radii. Boid count and velocity
+// are deposited on a periodic mesh over the [-1,1] torus with cloud-in-cell
+// weights, convolved with the interaction kernels through the FFT and
+// interpolated back to every boid with the same weights, so the cost is
+// O(n + G log G) whatever the radius.
+//
+// The kernels give, around every point, the neighbour count, the summed
+// offsets to the neighbours (hence their summed location) and the summed
+// velocities. Separation is split like P3M: it is steep enough that the mesh
+// smears it at close range, so pairs closer than near_radius are summed
+// exactly and only the rest comes from the mesh.
+class ParticleMesh
+{
+public:
+    size_t cells_per_side = 256; // Power of two
+    float near_radius = 0.0625f; // Exact separation range, kept above two mesh cells
+
+    template<typename Storage>
+    void Build(const BasicFlock<Storage>& flock)
+    {
+        if(!flock.periodic) throw std::runtime_error("Particle mesh needs a periodic flock");
+        size_t n = cells_per_side;
+        if(!IsPowerOfTwo(n)) throw std::runtime_error("Particle mesh needs a power of two cells per side");
+        BuildKernels(flock.InteractionRadius());
+
+        // Deposited with a private mesh per worker: count, vx, vy
+        size_t count = flock.size();
+        deposits.Run(count, n*n*3, cells, [&](double* cell_sums, size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+            {
+                Stencil stencil = Weights(flock.GetLocation(0, i), flock.GetLocation(1, i));
+                float vx = flock.GetVelocity(0, i), vy = flock.GetVelocity(1, i);
+                for(size_t s = 0; s < 4; s++)
+                {
+                    double* cell = &cell_sums[stencil.index[s]*3];
+                    cell[0] += stencil.weight[s];
+                    cell[1] += stencil.weight[s]*vx;
+                    cell[2] += stencil.weight[s]*vy;
+                }
+            }
+        });
+
+        density.resize(n*n);
+        momentum.resize(n*n);
+        ParallelFor(0, n*n, [&](size_t begin, size_t end)
+        {
+            for(size_t c = begin; c < end; c++)
+            {
+                density[c] = complex_type(cells[c*3], 0.0);
+                momentum[c] = complex_type(cells[c*3 + 1], cells[c*3 + 2]);
+            }
+        });
+        FFT2D(density, n, false);
+        FFT2D(momentum, n, false);
+
+        // Real kernels convolved with a real field give real results, so the
+        // vector quantities ride in the real and imaginary parts of one grid
+        Convolve(density, count_kernel, count_field);
+        Convolve(density, offset_kernel, offset_field);
+        Convolve(density, seperation_kernel, seperation_field);
+        Convolve(momentum, count_kernel, velocity_field);
+
+        seperation_grid.Build(flock, seperation_radius);
+    }
+
+    // Accumulates the flocking rules for every boid from the mesh. The mesh
+    // holds the built in rules' sums, so a rule flock is refused.
+    template<typename FlockType>
+    void Update(FlockType& flock) const
+    {
+        static_assert(FlockType::builtin_rules, "ParticleMesh only computes the built in rules");
+        ParallelFor(0, flock.size(), [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+                UpdateBoid(flock, i);
+        });
+    }
+
+private:
+    struct Stencil
+    {
+        size_t index[4];
+        float weight[4];
+    };
+
+    ScatterSums<double> deposits;
+    std::vector<double> cells;
+    std::vector<complex_type> density, momentum;
+    std::vector<complex_type> count_field, offset_field, seperation_field, velocity_field;
+
+    // Transformed kernels, rebuilt when the radius or mesh changes
+    std::vector<complex_type> count_kernel, offset_kernel, seperation_kernel;
+    float kernel_radius = 0.f, kernel_near_radius = 0.f;
+    size_t kernel_cells = 0;
+
+    UniformGrid seperation_grid;
+    float seperation_radius = 0.f;
+
+    float Spacing() const { return 2.f/cells_per_side; }
+
+    // Cloud-in-cell weights of the four mesh nodes around (x, y), wrapping
+    Stencil Weights(float x, float y) const
+    {
+        size_t n = cells_per_side;
+        float u = (x + 1.f)/Spacing(), v = (y + 1.f)/Spacing();
+        float u0 = floorf(u), v0 = floorf(v);
+        float fu = u - u0, fv = v - v0;
+        size_t x0 = static_cast<size_t>(static_cast<long>(u0) & static_cast<long>(n - 1)), x1 = (x0 + 1) & (n - 1);
+        size_t y0 = static_cast<size_t>(static_cast<long>(v0) & static_cast<long>(n - 1)), y1 = (y0 + 1) & (n - 1);
+        return Stencil{{y0*n + x0, y0*n + x1, y1*n + x0, y1*n + x1},
+            {(1.f - fu)*(1.f - fv), fu*(1.f - fv), (1.f - fu)*fv, fu*fv}};
+    }
+
+    void BuildKernels(float radius)
+    {
+        size_t n = cells_per_side;
+        // Two cells keeps a boid from separating from its own deposit
+        seperation_radius = std::min(radius, std::max(near_radius, 2.f*Spacing()));
+        if(radius == kernel_radius && n == kernel_cells && near_radius == kernel_near_radius) return;
+        kernel_radius = radius;
+        kernel_cells = n;
+        kernel_near_radius = near_radius;
+
+        // Kernel node m sits at the offset m*spacing taken on the torus
+        float radius_squared = radius*radius;
+        float near_squared = seperation_radius*seperation_radius;
+        count_kernel.assign(n*n, complex_type());
+        offset_kernel.assign(n*n, complex_type());
+        seperation_kernel.assign(n*n, complex_type());
+        for(size_t y = 0; y < n; y++)
+            for(size_t x = 0; x < n; x++)
+            {
+                float ox = MinimumImage(x*Spacing()), oy = MinimumImage(y*Spacing());
+                float dist = ox*ox + oy*oy;
+                if(dist > radius_squared) continue;
+                size_t c = y*n + x;
+                count_kernel[c] = complex_type(1.0, 0.0);
+                offset_kernel[c] = complex_type(ox, oy);
+                if(dist > near_squared)
+                    seperation_kernel[c] = complex_type(ox/(dist*dist), oy/(dist*dist));
+            }
+        FFT2D(count_kernel, n, false);
+        FFT2D(offset_kernel, n, false);
+        FFT2D(seperation_kernel, n, false);
+    }
+
+    void Convolve(const std::vector<complex_type>& field, const std::vector<complex_type>& kernel, std::vector<complex_type>& result) const
+    {
+        result.resize(field.size());
+        ParallelFor(0, field.size(), [&](size_t begin, size_t end)
+        {
+            for(size_t c = begin; c < end; c++)
+                result[c] = field[c]*kernel[c];
+        });
+        FFT2D(result, cells_per_side, true);
+    }
+
+    template<typename Storage>
+    void UpdateBoid(BasicFlock<Storage>& flock, size_t primary) const
+    {
+        typedef BasicFlock<Storage> FlockType;
+        float p[2] = {flock.GetLocation(0, primary), flock.GetLocation(1, primary)};
+        float v[2] = {flock.GetVelocity(0, primary), flock.GetVelocity(1, primary)};
+
+        Stencil stencil = Weights(p[0], p[1]);
+        double count = 0.0;
+        complex_type offset, seperation, velocity;
+        for(size_t s = 0; s < 4; s++)
+        {
+            size_t c = stencil.index[s];
+            double w = stencil.weight[s];
+            count += w*count_field[c].real();
+            offset += w*offset_field[c];
+            seperation += w*seperation_field[c];
+            velocity += w*velocity_field[c];
+        }
+
+        // The primary's own deposit counts once with its own velocity and,
+        // the offset kernel being odd, adds nothing to the offsets
+        typename FlockType::NeighborSums sums;
+        sums.count = static_cast<float>(count - 1.0);
+        if(sums.count < 0.5f) return;
+        sums.location[0] = sums.count*p[0] - static_cast<float>(offset.real());
+        sums.location[1] = sums.count*p[1] - static_cast<float>(offset.imag());
+        sums.velocity[0] = static_cast<float>(velocity.real()) - v[0];
+        sums.velocity[1] = static_cast<float>(velocity.imag()) - v[1];
+        sums.seperation[0] = static_cast<float>(seperation.real());
+        sums.seperation[1] = static_cast<float>(seperation.imag());
+
+        AddShortRangeSeperation(flock, seperation_grid, primary, p, seperation_radius, sums);
+        flock.Finish(primary, sums);
+    }
+};
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef PREDATORS_H
+#define PREDATORS_H
+
+#include "Boid.h"
+#include "Grid.h"
+
+// Second agent class hunting a flock. Predators chase the centre of the prey
+// they can see and prey flee any predator within flee_radius.
+//
+// Both sides are binned into grids with the same cells (flee_radius wide) once
+// per step. Prey are handled a cell at a time: the predators around a cell
+// are gathered once and shared by every prey in it, and predators only read
+// per cell prey totals, so a step costs O(prey + predators).
+//
+// Predators keep their state in a privately inherited Flock, so they share its
+// arrays, accessors and fused integrator, with their own limits. Only the
+// storage and Integrate() are exposed: a predator is not a flock and cannot be
+// handed to anything that would run the boid rules on it.
+class Predators : private Flock
+{
+public:
+    using Flock::dimension;
+    using Flock::location;
+    using Flock::velocity;
+    using Flock::acceleration;
+    using Flock::size;
+    using Flock::Resize;
+    using Flock::GetLocation;
+    using Flock::GetVelocity;
+    using Flock::SetLocation;
+    using Flock::SetVelocity;
+    using Flock::Integrate;
+
+    float sight = 0.2f;             // Predators see prey this far
+    float flee_radius = 0.05f;      // Prey see predators this far
+    float flee_strength = 0.002f;   // Prey acceleration at a predator's position
+
+    Predators() : Flock(0.f, 0.0008f, 0.015f) {};
+
+    // Indexes both populations, then accumulates the chase and flee rules.
+    // Prey acceleration is added to whatever the flock rules leave there.
+    template<typename Storage>
+    void Update(BasicFlock<Storage>& prey)
+    {
+        Index(prey);
+        Scare(prey);
+        Chase(prey.periodic);
+    }
+
+    // Bins prey and predators into grids of flee_radius cells and sums the
+    // prey of each cell. Scare and Chase read these.
+    template<typename Storage>
+    void Index(const BasicFlock<Storage>& prey)
+    {
+        prey_grid.Build(prey, flee_radius);
+        predator_grid.Build(*this, flee_radius);
+        SumPreyCells(prey);
+    }
+
+    // Batched range query: one predator lookup per prey cell. Needs Index()
+    template<typename Storage>
+    void Scare(BasicFlock<Storage>& prey) const
+    {
+        if(size() == 0) return;
+        size_t n = prey_grid.cells_per_side;
+        float radius_squared = flee_radius*flee_radius;
+        ParallelFor(0, n*n, [&](size_t begin, size_t end)
+        {
+            std::vector<uint32_t> nearby;
+            for(size_t cell = begin; cell < end; cell++)
+            {
+                if(prey_grid.cell_start[cell] == prey_grid.cell_start[cell + 1]) continue;
+                nearby.clear();
+                predator_grid.ForEachNeighborCell(cell%n, cell/n, prey.periodic, [&](size_t other)
+                {
+                    for(uint32_t c = predator_grid.cell_start[other]; c < predator_grid.cell_start[other + 1]; c++)
+                        nearby.push_back(predator_grid.sorted[c]);
+                });
+                if(nearby.empty()) continue;
+
+                for(uint32_t c = prey_grid.cell_start[cell]; c < prey_grid.cell_start[cell + 1]; c++)
+                {
+                    uint32_t i = prey_grid.sorted[c];
+                    float p[dimension] = {prey.GetLocation(0, i), prey.GetLocation(1, i)};
+                    float flee[dimension] = {};
+                    for(uint32_t j: nearby)
+                    {
+                        float offset[dimension];
+                        for(size_t d = 0; d < dimension; d++)
+                        {
+                            offset[d] = p[d] - location[d][j];
+                            if(prey.periodic) offset[d] = MinimumImage(offset[d]);
+                        }
+                        float dist = offset[0]*offset[0] + offset[1]*offset[1];
+                        if(dist > radius_squared || dist == 0.f) continue;
+                        // Strongest next to the predator, fading out at flee_radius
+                        float scale = flee_strength*(1.f/sqrtf(dist) - 1.f/flee_radius);
+                        for(size_t d = 0; d < dimension; d++)
+                            flee[d] += scale*offset[d];
+                    }
+                    for(size_t d = 0; d < dimension; d++)
+                        prey.acceleration[d][i] += flee[d];
+                }
+            }
+        });
+    }
+
+    // Steer for the centre of the prey cells within sight. Needs Index()
+    void Chase(bool periodic)
+    {
+        long n = static_cast<long>(prey_grid.cells_per_side);
+        float cell_size = 2.f/n;
+        long reach = std::min<long>(n/2, static_cast<long>(ceilf(sight/cell_size)));
+        // At most n cells per row and column, so no cell is counted twice
+        long span = std::min(2*reach + 1, n);
+        float sight_squared = sight*sight;
+        ParallelFor(0, size(), [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+            {
+                float p[dimension] = {location[0][i], location[1][i]};
+                long cx = static_cast<long>(prey_grid.CellCoordinate(p[0])), cy = static_cast<long>(prey_grid.CellCoordinate(p[1]));
+                float count = 0.f, target[dimension] = {};
+                for(long y = cy - reach; y < cy - reach + span; y++)
+                    for(long x = cx - reach; x < cx - reach + span; x++)
+                    {
+                        if(!periodic && (x < 0 || y < 0 || x >= n || y >= n)) continue;
+                        size_t column = static_cast<size_t>((x%n + n)%n), row = static_cast<size_t>((y%n + n)%n);
+                        size_t cell = row*n + column;
+                        if(cell_count[cell] == 0.f) continue;
+                        // Offset from the predator to the cell's prey centre
+                        float offset[dimension];
+                        for(size_t d = 0; d < dimension; d++)
+                        {
+                            float center = CellCenter(d == 0 ? column : row);
+                            offset[d] = center + cell_offset[d][cell]/cell_count[cell] - p[d];
+                            if(periodic) offset[d] = MinimumImage(offset[d]);
+                        }
+                        if(offset[0]*offset[0] + offset[1]*offset[1] > sight_squared) continue;
+                        count += cell_count[cell];
+                        for(size_t d = 0; d < dimension; d++)
+                            target[d] += cell_count[cell]*offset[d];
+                    }
+                if(count == 0.f) continue;
+
+                float steer[dimension] = {target[0]/count, target[1]/count};
+                NormalizeVectorInPlace(steer, Parameters().max_velocity_magnitude);
+                for(size_t d = 0; d < dimension; d++)
+                    acceleration[d][i] += steer[d] - velocity[d][i];
+            }
+        });
+    }
+
+private:
+    UniformGrid prey_grid, predator_grid;
+
+    // Prey count and summed offset from the cell centre, per cell
+    std::vector<float> cell_count;
+    std::vector<float> cell_offset[dimension];
+
+    float CellCenter(size_t c) const { return -1.f + (c + 0.5f)*2.f/prey_grid.cells_per_side; }
+
+    template<typename Storage>
+    void SumPreyCells(const BasicFlock<Storage>& prey)
+    {
+        size_t n = prey_grid.cells_per_side;
+        cell_count.resize(n*n);
+        cell_offset[0].resize(n*n);
+        cell_offset[1].resize(n*n);
+        ParallelFor(0, n*n, [&](size_t begin, size_t end)
+        {
+            for(size_t cell = begin; cell < end; cell++)
+            {
+                float center[dimension] = {CellCenter(cell%n), CellCenter(cell/n)};
+                float offset[dimension] = {};
+                for(uint32_t c = prey_grid.cell_start[cell]; c < prey_grid.cell_start[cell + 1]; c++)
+                    for(size_t d = 0; d < dimension; d++)
+                        offset[d] += MinimumImage(prey.GetLocation(d, prey_grid.sorted[c]) - center[d]);
+                cell_count[cell] = static_cast<float>(prey_grid.cell_start[cell + 1] - prey_grid.cell_start[cell]);
+                cell_offset[0][cell] = offset[0];
+                cell_offset[1][cell] = offset[1];
+            }
+        });
+    }
+};
+
+#endif
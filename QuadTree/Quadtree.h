@@ -1,30 +1,66 @@
+#include <cstddef>
 #include <vector>
 
 #ifndef QUADTREE_H
 #define QUADTREE_H
 
-template<typename T>
+typedef std::vector<size_t> size_t_vector;
+
+// Buckets hold indices into the flock's structure of arrays
 struct point_bucket
 {
     point_bucket(float x, float y, float x_length, float y_length) : x{x}, y{y}, x_length{x_length}, y_length{y_length} {}
 
-    point_bucket(float x, float y, float x_length, float y_length, std::vector<T*>& bucket) : x{x}, y{y}, x_length{x_length}, y_length{y_length}, bucket{bucket} {}
+    point_bucket(float x, float y, float x_length, float y_length, size_t_vector& bucket) : x{x}, y{y}, x_length{x_length}, y_length{y_length}, bucket{bucket} {}
 
-    point_bucket(float x, float y, float x_length, float y_length, std::vector<T>& bucket) : x{x}, y{y}, x_length{x_length}, y_length{y_length} 
+    point_bucket(float x, float y, float x_length, float y_length, size_t count) : x{x}, y{y}, x_length{x_length}, y_length{y_length}
     {
-        this->bucket.reserve(bucket.size());
-        for(auto& elm: bucket)
-            this->bucket.push_back(&elm);
+        this->bucket.reserve(count);
+        for(size_t i = 0; i < count; i++)
+            this->bucket.push_back(i);
     }
 
     float x;
     float y;
     float x_length;
     float y_length;
-    std::vector<T*> bucket;
+    size_t_vector bucket;
+};
+
+// Box of the N-D tree (quadtree in 2D, octree in 3D) holding its members.
+// length is the full side along each axis.
+template<size_t Dimension>
+struct orthant_bucket
+{
+    orthant_bucket() {}
+
+    orthant_bucket(const float (&center)[Dimension], const float (&length)[Dimension])
+    {
+        for(size_t d = 0; d < Dimension; d++)
+        {
+            this->center[d] = center[d];
+            this->length[d] = length[d];
+        }
+    }
+
+    // Root box [-1,1]^Dimension holding boids 0..count-1
+    explicit orthant_bucket(size_t count)
+    {
+        for(size_t d = 0; d < Dimension; d++)
+        {
+            center[d] = 0.f;
+            length[d] = 2.f;
+        }
+        bucket.reserve(count);
+        for(size_t i = 0; i < count; i++)
+            bucket.push_back(i);
+    }
+
+    float center[Dimension];
+    float length[Dimension];
+    size_t_vector bucket;
 };
 
-template<typename T>
-void base_split(point_bucket<T>& base, size_t max_size, std::vector<point_bucket<T> >& tree, float min_resolution);
+typedef orthant_bucket<3> octree_bucket;
 
-#endif
\ No newline at end of file
+#endif
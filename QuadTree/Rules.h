@@ -0,0 +1,280 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include "Boid.h"
+#include <tuple>
+#include <utility>
+
+// Steering rules as policy types, composed at compile time by
+// BasicRuleFlock<FlockType, Rules...>. A rule has
+//   template<size_t D> struct Sums              per boid running totals
+//   Accumulate(sums, boid, neighbor) const      once per flockmate in range
+//   Finalize(sums, boid, acceleration) const    once per boid, adds its steering
+// The flock walks the candidates once and calls every rule's Accumulate from
+// that one loop, then every Finalize in the order the rules are listed. All
+// of it is inlined, so a rule costs no virtual call or extra pass, and a rule
+// left out of the list is not compiled at all. Rules that only look at the
+// boid itself (goals, preferred speed) derive from BoidRule.
+
+// The boid a rule steers
+template<size_t Dimension>
+struct RuleBoid
+{
+    size_t index;
+    float location[Dimension];
+    float velocity[Dimension];
+    float neighbors;            // Flockmates in range, set before Finalize
+    FlockParameters limits;
+};
+
+// One flockmate within the interaction radius
+template<size_t Dimension>
+struct RuleNeighbor
+{
+    size_t index;
+    float offset[Dimension];    // Primary minus neighbour, at the closest image
+    float dist;                 // Squared length of offset
+    float velocity[Dimension];
+};
+
+// Base for rules with nothing to gather from the neighbours
+struct BoidRule
+{
+    template<size_t D>
+    struct Sums {};
+
+    template<size_t D>
+    void Accumulate(Sums<D>&, const RuleBoid<D>&, const RuleNeighbor<D>&) const {}
+};
+
+// Away from flockmates, inverse square of the distance. Like BasicFlock the
+// total is added to the acceleration so far and capped together with it.
+struct SeperationRule
+{
+    template<size_t D>
+    struct Sums { float seperation[D] = {}; };
+
+    template<size_t D>
+    void Accumulate(Sums<D>& sums, const RuleBoid<D>&, const RuleNeighbor<D>& neighbor) const
+    {
+        if(neighbor.dist == 0.f) return;
+        float distance = fmaxf(neighbor.dist, Flock::min_seperation_distance);
+        for(size_t d = 0; d < D; d++)
+            sums.seperation[d] += neighbor.offset[d]/(distance*distance);
+    }
+
+    template<size_t D>
+    void Finalize(const Sums<D>& sums, const RuleBoid<D>& boid, float (&acceleration)[D]) const
+    {
+        if(boid.neighbors == 0.f) return;
+        for(size_t d = 0; d < D; d++)
+            acceleration[d] += sums.seperation[d];
+        CapVector(acceleration, boid.limits.max_acceleration_magnitude, boid.limits.max_acceleration_magnitude);
+    }
+};
+
+// Towards the flockmates' average velocity
+struct AlignmentRule
+{
+    template<size_t D>
+    struct Sums { float velocity[D] = {}; };
+
+    template<size_t D>
+    void Accumulate(Sums<D>& sums, const RuleBoid<D>&, const RuleNeighbor<D>& neighbor) const
+    {
+        for(size_t d = 0; d < D; d++)
+            sums.velocity[d] += neighbor.velocity[d];
+    }
+
+    template<size_t D>
+    void Finalize(const Sums<D>& sums, const RuleBoid<D>& boid, float (&acceleration)[D]) const
+    {
+        if(boid.neighbors == 0.f) return;
+        float steer[D];
+        for(size_t d = 0; d < D; d++)
+            steer[d] = sums.velocity[d]/boid.neighbors - boid.velocity[d];
+        CapVector(steer, boid.limits.max_acceleration_magnitude, boid.limits.max_acceleration_magnitude);
+        for(size_t d = 0; d < D; d++)
+            acceleration[d] += steer[d];
+    }
+};
+
+// Towards the flockmates' average location
+struct CohesionRule
+{
+    template<size_t D>
+    struct Sums { float location[D] = {}; };
+
+    template<size_t D>
+    void Accumulate(Sums<D>& sums, const RuleBoid<D>& boid, const RuleNeighbor<D>& neighbor) const
+    {
+        for(size_t d = 0; d < D; d++)
+            sums.location[d] += boid.location[d] - neighbor.offset[d];
+    }
+
+    template<size_t D>
+    void Finalize(const Sums<D>& sums, const RuleBoid<D>& boid, float (&acceleration)[D]) const
+    {
+        if(boid.neighbors == 0.f) return;
+        float steer[D];
+        for(size_t d = 0; d < D; d++)
+            steer[d] = sums.location[d]/boid.neighbors - boid.location[d] - boid.velocity[d];
+        CapVector(steer, boid.limits.max_acceleration_magnitude, boid.limits.max_acceleration_magnitude);
+        for(size_t d = 0; d < D; d++)
+            acceleration[d] += steer[d];
+    }
+};
+
+// Towards a fixed point, along the shortest way on the torus
+struct GoalRule : BoidRule
+{
+    float goal[3] = {};
+    float strength = 0.1f;      // Fraction of the offset steered per step, before the cap
+    bool periodic = true;
+
+    template<size_t D>
+    void Finalize(const Sums<D>&, const RuleBoid<D>& boid, float (&acceleration)[D]) const
+    {
+        float steer[D];
+        for(size_t d = 0; d < D; d++)
+        {
+            float offset = goal[d] - boid.location[d];
+            steer[d] = strength*(periodic ? MinimumImage(offset) : offset);
+        }
+        CapVector(steer, boid.limits.max_acceleration_magnitude, boid.limits.max_acceleration_magnitude);
+        for(size_t d = 0; d < D; d++)
+            acceleration[d] += steer[d];
+    }
+};
+
+// Speeds up or slows down along the current heading towards a preferred speed
+struct SpeedRule : BoidRule
+{
+    float speed = 0.005f;
+    float strength = 0.1f;
+
+    template<size_t D>
+    void Finalize(const Sums<D>&, const RuleBoid<D>& boid, float (&acceleration)[D]) const
+    {
+        float squared = 0.f;
+        for(size_t d = 0; d < D; d++)
+            squared += boid.velocity[d]*boid.velocity[d];
+        if(squared == 0.f) return;
+        float scale = strength*(speed/sqrtf(squared) - 1.f);
+        float steer[D];
+        for(size_t d = 0; d < D; d++)
+            steer[d] = scale*boid.velocity[d];
+        CapVector(steer, boid.limits.max_acceleration_magnitude, boid.limits.max_acceleration_magnitude);
+        for(size_t d = 0; d < D; d++)
+            acceleration[d] += steer[d];
+    }
+};
+
+// A flock (any BasicFlock) whose Update applies Rules instead of the built in
+// three. With SeperationRule, AlignmentRule, CohesionRule it matches the base
+// flock's update, small leaf kernels or not, exactly. builtin_rules is false,
+// so every index is templated on the flock type and calls Update or
+// UpdateNeighbors rather than gathering the base flock's sums; those that only
+// work on the built in sums (mean field, particle mesh) refuse it at compile
+// time.
+template<typename FlockType, typename... Rules>
+class BasicRuleFlock : public FlockType
+{
+public:
+    static const size_t dimension = FlockType::dimension;
+    static constexpr bool builtin_rules = false;
+
+    std::tuple<Rules...> rules;
+
+    using FlockType::FlockType;
+
+    template<typename Rule>
+    Rule& GetRule() { return std::get<Rule>(rules); }
+
+    void Update(const size_t_vector& miniFlock)
+    {
+        if(miniFlock.size() < 2) return;
+        for(size_t primary: miniFlock)
+            Update(primary, miniFlock.begin(), miniFlock.end());
+    }
+
+    template<typename Iterator>
+    void Update(size_t primary, Iterator begin, Iterator end)
+    {
+        this->periodic ? UpdateBoid<true, true>(primary, begin, end) : UpdateBoid<false, true>(primary, begin, end);
+    }
+
+    template<typename Iterator>
+    void UpdateNeighbors(size_t primary, Iterator begin, Iterator end)
+    {
+        this->periodic ? UpdateBoid<true, false>(primary, begin, end) : UpdateBoid<false, false>(primary, begin, end);
+    }
+
+private:
+    typedef std::tuple<typename Rules::template Sums<dimension>...> SumsTuple;
+    typedef std::index_sequence_for<Rules...> RuleIndices;
+
+    template<bool Periodic, bool InRangeOnly, typename Iterator>
+    void UpdateBoid(size_t primary, Iterator begin, Iterator end)
+    {
+        RuleBoid<dimension> boid;
+        boid.index = primary;
+        boid.limits = this->Parameters();
+        for(size_t d = 0; d < dimension; d++)
+        {
+            boid.location[d] = this->GetLocation(d, primary);
+            boid.velocity[d] = this->GetVelocity(d, primary);
+        }
+
+        SumsTuple sums;
+        float count = 0.f;
+        for(Iterator iter = begin; iter != end; ++iter)
+        {
+            RuleNeighbor<dimension> neighbor;
+            neighbor.index = *iter;
+            if(neighbor.index == primary) continue;
+            neighbor.dist = 0.f;
+            for(size_t d = 0; d < dimension; d++)
+            {
+                float offset = boid.location[d] - this->GetLocation(d, neighbor.index);
+                neighbor.offset[d] = Periodic ? MinimumImage(offset) : offset;
+                neighbor.dist += neighbor.offset[d]*neighbor.offset[d];
+            }
+            if(InRangeOnly && neighbor.dist > boid.limits.max_dist) continue;
+            for(size_t d = 0; d < dimension; d++)
+                neighbor.velocity[d] = this->GetVelocity(d, neighbor.index);
+            count += 1.f;
+            Accumulate(sums, boid, neighbor, RuleIndices());
+        }
+        boid.neighbors = count;
+
+        float acceleration[dimension];
+        for(size_t d = 0; d < dimension; d++)
+            acceleration[d] = this->acceleration[d][primary];
+        Finalize(sums, boid, acceleration, RuleIndices());
+        for(size_t d = 0; d < dimension; d++)
+            this->acceleration[d][primary] = acceleration[d];
+    }
+
+    template<size_t... I>
+    void Accumulate(SumsTuple& sums, const RuleBoid<dimension>& boid, const RuleNeighbor<dimension>& neighbor, std::index_sequence<I...>) const
+    {
+        (void)sums; (void)boid; (void)neighbor;
+        (std::get<I>(rules).Accumulate(std::get<I>(sums), boid, neighbor), ...);
+    }
+
+    template<size_t... I>
+    void Finalize(const SumsTuple& sums, const RuleBoid<dimension>& boid, float (&acceleration)[dimension], std::index_sequence<I...>) const
+    {
+        (void)sums; (void)boid; (void)acceleration;
+        (std::get<I>(rules).Finalize(std::get<I>(sums), boid, acceleration), ...);
+    }
+};
+
+template<typename... Rules>
+using RuleFlock = BasicRuleFlock<Flock, Rules...>;
+
+// The built in rules, spelled out
+typedef RuleFlock<SeperationRule, AlignmentRule, CohesionRule> ClassicRuleFlock;
+
+#endif
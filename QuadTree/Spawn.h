@@ -0,0 +1,196 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include "Boid.h"
+#include "Parallel.h"
+#include <cstdint>
+
+// Counter-based RNG (Widynski's "Squares"). Every draw is a pure function of
+// (key, counter) so boids can be generated in any order on any number of threads.
+inline uint32_t Squares32(uint64_t counter, uint64_t key)
+{
+    uint64_t x, y, z;
+    y = x = counter*key;
+    z = y + key;
+    x = x*x + y; x = (x >> 32) | (x << 32);
+    x = x*x + z; x = (x >> 32) | (x << 32);
+    x = x*x + y; x = (x >> 32) | (x << 32);
+    return static_cast<uint32_t>((x*x + z) >> 32);
+}
+
+// Squares wants a key with well mixed bits, so scramble the user seed first
+inline uint64_t SquaresKey(uint64_t seed)
+{
+    uint64_t z = seed + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return z | 1;
+}
+
+// Draws shared across boids come from streams keyed apart from the per boid
+// draws. Each stream hashes the spawn key with its own tag in the top byte;
+// the mix in SquaresKey is a bijection, so different tags give keys that can
+// only meet if they differ in the forced low bit alone.
+enum class SpawnStream : uint64_t
+{
+    Clusters = 0,   // Cluster centres and headings, indexed by cluster
+    Extra = 1,      // Coordinates past the plane, indexed by boid
+};
+
+inline uint64_t StreamKey(uint64_t key, SpawnStream stream)
+{
+    return SquaresKey(key ^ (static_cast<uint64_t>(stream) << 56));
+}
+
+enum class SpawnDistribution
+{
+    Uniform,    // Location and velocity uniform in [-1,1]
+    Clusters,   // Gaussian blobs, each heading in its own direction
+    Ring,       // Gaussian band around a circle, random headings
+    Vortex      // Uniform disk rotating about the origin
+};
+
+struct SpawnConfig
+{
+    SpawnDistribution distribution = SpawnDistribution::Uniform;
+    uint64_t seed = 100;
+    size_t cluster_count = 8;
+    float spread = 0.05f;   // Standard deviation of clusters and ring width
+    float radius = 0.6f;    // Ring and vortex radius
+    float speed = 0.01f;    // Cluster heading and vortex rim speed
+};
+
+class BoidSampler
+{
+public:
+    static const uint64_t draws_per_boid = 8;
+    // M_PI needs _USE_MATH_DEFINES on MSVC
+    static constexpr float two_pi = 6.28318530717958647692f;
+
+    BoidSampler(uint64_t key, uint64_t index) : key(key), counter(index*draws_per_boid) {};
+
+    // Uniform in [0,1)
+    float Uniform()
+    {
+        return static_cast<float>(Squares32(counter++, key) >> 8)*(1.f/16777216.f);
+    }
+
+    // Uniform in [-1,1)
+    float Signed()
+    {
+        return 2.f*Uniform() - 1.f;
+    }
+
+    // Box-Muller, returns a pair of independent standard normals
+    void Gaussian(float& a, float& b)
+    {
+        float u = 1.f - Uniform();
+        float v = Uniform();
+        float r = sqrtf(-2.f*logf(u));
+        a = r*cosf(two_pi*v);
+        b = r*sinf(two_pi*v);
+    }
+
+private:
+    uint64_t key;
+    uint64_t counter;
+};
+
+inline float WrapUnit(float val)
+{
+    val = fmodf(val + 1.f, 2.f);
+    if(val < 0.f) val += 2.f;
+    return val - 1.f;
+}
+
+// State of boid `index` depends only on (config, index), never on thread count
+inline void SpawnBoid(const SpawnConfig& config, uint64_t key, uint64_t index, float (&location)[2], float (&velocity)[2])
+{
+    BoidSampler sample(key, index);
+
+    switch(config.distribution)
+    {
+    case SpawnDistribution::Uniform:
+        location[0] = sample.Signed();
+        location[1] = sample.Signed();
+        velocity[0] = sample.Signed();
+        velocity[1] = sample.Signed();
+        break;
+    case SpawnDistribution::Clusters:
+    {
+        // Cluster centers and headings are drawn from their own key so they
+        // are shared by every boid in the cluster
+        size_t cluster_count = std::max<size_t>(1, config.cluster_count);
+        size_t cluster = std::min(cluster_count - 1, static_cast<size_t>(sample.Uniform()*cluster_count));
+        BoidSampler center(StreamKey(key, SpawnStream::Clusters), cluster);
+        float cx = center.Signed(), cy = center.Signed();
+        float heading = BoidSampler::two_pi*center.Uniform();
+        float gx, gy;
+        sample.Gaussian(gx, gy);
+        location[0] = WrapUnit(cx + gx*config.spread);
+        location[1] = WrapUnit(cy + gy*config.spread);
+        sample.Gaussian(gx, gy);
+        velocity[0] = config.speed*(cosf(heading) + 0.1f*gx);
+        velocity[1] = config.speed*(sinf(heading) + 0.1f*gy);
+        break;
+    }
+    case SpawnDistribution::Ring:
+    {
+        float angle = BoidSampler::two_pi*sample.Uniform();
+        float gx, gy;
+        sample.Gaussian(gx, gy);
+        float r = config.radius + gx*config.spread;
+        location[0] = WrapUnit(r*cosf(angle));
+        location[1] = WrapUnit(r*sinf(angle));
+        velocity[0] = sample.Signed();
+        velocity[1] = sample.Signed();
+        break;
+    }
+    case SpawnDistribution::Vortex:
+    {
+        float angle = BoidSampler::two_pi*sample.Uniform();
+        float r = config.radius*sqrtf(sample.Uniform());
+        // Radius 0 stacks every boid at rest on the origin
+        float s = config.radius != 0.f ? config.speed*r/config.radius : 0.f;
+        location[0] = WrapUnit(r*cosf(angle));
+        location[1] = WrapUnit(r*sinf(angle));
+        velocity[0] = -s*sinf(angle);
+        velocity[1] = s*cosf(angle);
+        break;
+    }
+    }
+}
+
+// Resizes the flock to `count` boids and fills it in parallel. Works for any
+// agents with Resize, SetLocation, SetVelocity and acceleration arrays.
+template<typename Agents>
+void SpawnFlock(Agents& flock, size_t count, const SpawnConfig& config = SpawnConfig())
+{
+    uint64_t key = SquaresKey(config.seed), extra_key = StreamKey(key, SpawnStream::Extra);
+    flock.Resize(count);
+    ParallelFor(0, count, [&](size_t begin, size_t end)
+    {
+        for(size_t i = begin; i < end; i++)
+        {
+            float location[2], velocity[2];
+            SpawnBoid(config, key, i, location, velocity);
+            for(size_t d = 0; d < 2; d++)
+            {
+                flock.SetLocation(d, i, location[d]);
+                flock.SetVelocity(d, i, velocity[d]);
+                flock.acceleration[d][i] = 0.f;
+            }
+            // Dimensions past the plane are uniform, from their own stream
+            BoidSampler extra(extra_key, i);
+            for(size_t d = 2; d < Agents::dimension; d++)
+            {
+                flock.SetLocation(d, i, extra.Signed());
+                flock.SetVelocity(d, i, config.speed*extra.Signed());
+                flock.acceleration[d][i] = 0.f;
+            }
+        }
+    });
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef SPECIES_H
+#define SPECIES_H
+
+#include "Boid.h"
+#include "Grid.h"
+
+typedef FlockParameters SpeciesParameters;
+
+// How a boid of one species reacts to a boid of another
+struct SpeciesInteraction
+{
+    float seperation = 1.f;
+    float flocking = 1.f;   // Weight in the cohesion and alignment averages
+};
+
+// Several species in one simulation. Every species is its own BasicFlock, so
+// its boids are contiguous and it keeps its own radius and limits, and the
+// interaction matrix says how species a treats species b. Rules are gathered
+// a species pair block at a time, with that pair's weights and radius hoisted
+// out of the pair loop rather than looked up per pair.
+template<typename Storage = FloatStorage>
+class BasicSpeciesFlock
+{
+public:
+    typedef BasicFlock<Storage> FlockType;
+    typedef typename FlockType::NeighborSums NeighborSums;
+
+    std::vector<FlockType> species;
+
+    size_t Count() const { return species.size(); }
+
+    size_t size() const
+    {
+        size_t retval = 0;
+        for(auto& elm: species)
+            retval += elm.size();
+        return retval;
+    }
+
+    // Adds an empty species that only flocks with itself and separates from all
+    size_t AddSpecies(const SpeciesParameters& parameters)
+    {
+        size_t count = species.size();
+        species.push_back(FlockType());
+        species.back().SetParameters(parameters);
+        std::vector<SpeciesInteraction> grown((count + 1)*(count + 1));
+        for(size_t a = 0; a <= count; a++)
+            for(size_t b = 0; b <= count; b++)
+            {
+                if(a < count && b < count) grown[a*(count + 1) + b] = interaction[a*count + b];
+                else if(a != b) grown[a*(count + 1) + b].flocking = 0.f;
+            }
+        interaction.swap(grown);
+        return count;
+    }
+
+    SpeciesInteraction& Interaction(size_t a, size_t b) { return interaction[a*species.size() + b]; }
+    const SpeciesInteraction& Interaction(size_t a, size_t b) const { return interaction[a*species.size() + b]; }
+
+    // Accumulates the rules for every boid of every species
+    void Update()
+    {
+        size_t count = species.size();
+        grids.resize(count);
+        sums.resize(count);
+        for(size_t b = 0; b < count; b++)
+        {
+            // Cells as wide as the largest radius looking at this species
+            float cell = 0.f;
+            for(size_t a = 0; a < count; a++)
+                if(Interacts(a, b)) cell = std::max(cell, species[a].InteractionRadius());
+            grids[b].Build(species[b], cell > 0.f ? cell : 2.f);
+            sums[b].assign(species[b].size(), NeighborSums());
+        }
+
+        for(size_t a = 0; a < count; a++)
+            for(size_t b = 0; b < count; b++)
+                if(Interacts(a, b)) Block(a, b);
+
+        for(size_t a = 0; a < count; a++)
+        {
+            FlockType& flock = species[a];
+            ParallelFor(0, flock.size(), [&](size_t begin, size_t end)
+            {
+                for(size_t i = begin; i < end; i++)
+                {
+                    const NeighborSums& total = sums[a][i];
+                    // Finish needs flockmates, separation from other species must not
+                    if(total.count == 0.f)
+                        for(size_t d = 0; d < FlockType::dimension; d++)
+                            flock.acceleration[d][i] += total.seperation[d];
+                    else
+                        flock.Finish(i, total);
+                }
+            });
+        }
+    }
+
+    void Integrate()
+    {
+        for(auto& elm: species)
+            elm.Integrate();
+    }
+
+private:
+    std::vector<SpeciesInteraction> interaction;
+    std::vector<UniformGrid> grids;
+    std::vector<std::vector<NeighborSums> > sums;
+
+    bool Interacts(size_t a, size_t b) const
+    {
+        const SpeciesInteraction& weights = Interaction(a, b);
+        return weights.seperation != 0.f || weights.flocking != 0.f;
+    }
+
+    // Every boid of species a against the boids of species b around it
+    void Block(size_t a, size_t b)
+    {
+        const FlockType& primary_flock = species[a];
+        const FlockType& secondary_flock = species[b];
+        const UniformGrid& grid = grids[b];
+        const bool periodic = primary_flock.periodic;
+        const bool same = a == b;
+        const float seperation = Interaction(a, b).seperation, flocking = Interaction(a, b).flocking;
+        const float radius = primary_flock.InteractionRadius(), radius_squared = radius*radius;
+
+        ParallelFor(0, primary_flock.size(), [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+            {
+                float p[2] = {primary_flock.GetLocation(0, i), primary_flock.GetLocation(1, i)};
+                NeighborSums& total = sums[a][i];
+                grid.ForEachNeighborCell(grid.CellCoordinate(p[0]), grid.CellCoordinate(p[1]), periodic, [&](size_t cell)
+                {
+                    for(uint32_t c = grid.cell_start[cell]; c < grid.cell_start[cell + 1]; c++)
+                    {
+                        uint32_t j = grid.sorted[c];
+                        if(same && j == i) continue;
+                        float offset[2];
+                        for(size_t d = 0; d < 2; d++)
+                        {
+                            offset[d] = p[d] - secondary_flock.GetLocation(d, j);
+                            if(periodic) offset[d] = MinimumImage(offset[d]);
+                        }
+                        float dist = offset[0]*offset[0] + offset[1]*offset[1];
+                        if(dist > radius_squared) continue;
+
+                        FlockType::AddSeperation(total, offset, dist, seperation);
+                        total.count += flocking;
+                        for(size_t d = 0; d < 2; d++)
+                        {
+                            total.location[d] += flocking*(p[d] - offset[d]);
+                            total.velocity[d] += flocking*secondary_flock.GetVelocity(d, j);
+                        }
+                    }
+                });
+            }
+        });
+    }
+};
+
+typedef BasicSpeciesFlock<> SpeciesFlock;
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <math.h>
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+// Storage policies for BasicFlock. Each one picks the element types of the
+// location and velocity arrays and converts them to and from the fp32 values
+// the kernels compute with. Locations live on the [-1,1] torus and velocities
+// are capped by max_velocity_magnitude, so both fit in far fewer bits.
+
+inline uint16_t FloatToHalf(float value)
+{
+#ifdef __F16C__
+    return _cvtss_sh(value, 0);
+#else
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xffu) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffffu;
+
+    if(((bits >> 23) & 0xffu) == 0xffu) return static_cast<uint16_t>(sign | (mantissa ? 0x7e00u : 0x7c00u));
+    if(exponent >= 31) return static_cast<uint16_t>(sign | 0x7c00u);
+    if(exponent <= 0)
+    {
+        if(exponent < -10) return static_cast<uint16_t>(sign);
+        mantissa |= 0x800000u;
+        uint32_t shift = static_cast<uint32_t>(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if(rest > halfway || (rest == halfway && (half & 1u))) half++;
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fffu;
+    if(rest > 0x1000u || (rest == 0x1000u && (half & 1u))) half++;
+    return static_cast<uint16_t>(half);
+#endif
+}
+
+inline float HalfToFloat(uint16_t half)
+{
+#ifdef __F16C__
+    return _cvtsh_ss(half);
+#else
+    uint32_t sign = static_cast<uint32_t>(half & 0x8000u) << 16;
+    uint32_t exponent = (half >> 10) & 0x1fu;
+    uint32_t mantissa = half & 0x3ffu;
+    uint32_t bits;
+
+    if(exponent == 0)
+    {
+        if(mantissa == 0) bits = sign;
+        else
+        {
+            exponent = 127 - 15 + 1;
+            while(!(mantissa & 0x400u))
+            {
+                mantissa <<= 1;
+                exponent--;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+        }
+    }
+    else if(exponent == 31) bits = sign | 0x7f800000u | (mantissa << 13);
+    else bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+#endif
+}
+
+// Full precision, the default
+struct FloatStorage
+{
+    typedef float location_type;
+    typedef float velocity_type;
+    template<typename T> using allocator = std::allocator<T>;
+
+    static float LoadLocation(float value) { return value; }
+    static float StoreLocation(float value) { return value; }
+    static float LoadVelocity(float value) { return value; }
+    static float StoreVelocity(float value) { return value; }
+};
+
+// Signed fixed point spanning exactly [-1,1), so wrapping onto the torus is
+// plain integer overflow. Velocities are fp16.
+template<typename Integer, typename Unsigned, int FractionBits>
+struct FixedStorage
+{
+    typedef Integer location_type;
+    typedef uint16_t velocity_type;
+    template<typename T> using allocator = std::allocator<T>;
+
+    static float LoadLocation(Integer value)
+    {
+        return static_cast<float>(value)*(1.f/static_cast<float>(1LL << FractionBits));
+    }
+
+    static Integer StoreLocation(float value)
+    {
+        // +1 becomes -1, the same point on the torus
+        long long scaled = llrintf(value*static_cast<float>(1LL << FractionBits));
+        return static_cast<Integer>(static_cast<Unsigned>(scaled));
+    }
+
+    static float LoadVelocity(uint16_t value) { return HalfToFloat(value); }
+    static uint16_t StoreVelocity(float value) { return FloatToHalf(value); }
+};
+
+typedef FixedStorage<int32_t, uint32_t, 31> Fixed32Storage;
+typedef FixedStorage<int16_t, uint16_t, 15> Fixed16Storage;
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef SYMMETRIC_H
+#define SYMMETRIC_H
+
+#include "Boid.h"
+#include "Grid.h"
+
+// Radius exact update on a uniform grid that tests every pair once. Each cell
+// pairs its boids with each other and with the boids of half its 3x3 stencil
+// (east, north-west, north, north-east), and every pair in range is added to
+// both boids' sums with AddPair.
+//
+// A cell writes the sums of its own boids and of those in the cells it looks
+// at, a 3x2 block. Cells are coloured by (x mod 3, y mod 2), so two cells of
+// one colour never write the same boid, and the six colours run one after
+// the other with the cells of a colour in parallel, without locks or atomics.
+// On the torus the side is rounded down to a multiple of 6 so the colouring
+// also holds across the seam. A torus 3 to 5 cells wide cannot be coloured
+// that way, so it falls back to a full 3x3 stencil per boid, one cell per
+// task, testing each pair from both sides. So does a flock with rules other
+// than the built in ones, as AddPair only knows those; its own Update is
+// called on each boid's candidates.
+template<typename Storage = FloatStorage>
+class BasicSymmetricGrid
+{
+public:
+    typedef BasicFlock<Storage> FlockType;
+    typedef typename FlockType::NeighborSums NeighborSums;
+
+    UniformGrid grid;
+    size_t pair_tests = 0;      // Distance tests of the last Update
+
+    template<typename Agents>
+    void Update(Agents& flock)
+    {
+        size_t side = std::max<size_t>(1, static_cast<size_t>(2.f/flock.InteractionRadius()));
+        if(!Agents::builtin_rules || (flock.periodic && side >= 3 && side < 6))
+        {
+            grid.BuildCells(flock, side);
+            FullStencil(flock);
+            return;
+        }
+        // Under 3 cells every boid sees every other one anyway
+        if(flock.periodic) side = side < 3 ? 1 : side - side%6;
+        grid.BuildCells(flock, side);
+
+        if(colored_side != side)
+        {
+            for(size_t c = 0; c < 6; c++)
+            {
+                colors[c].clear();
+                for(size_t y = c/3; y < side; y += 2)
+                    for(size_t x = c%3; x < side; x += 3)
+                        colors[c].push_back(y*side + x);
+            }
+            colored_side = side;
+        }
+
+        sums.assign(flock.size(), NeighborSums());
+        pair_tests = 0;
+        for(size_t c = 0; c < 6; c++)
+        {
+            const std::vector<size_t>& cells = colors[c];
+            pair_tests += ParallelReduce(0, cells.size(), size_t(0), [&](size_t begin, size_t end)
+            {
+                size_t tests = 0;
+                for(size_t k = begin; k < end; k++)
+                    tests += flock.periodic ? Cell<true>(flock, cells[k]) : Cell<false>(flock, cells[k]);
+                return tests;
+            }, [](size_t a, size_t b) { return a + b; });
+        }
+
+        ParallelFor(0, flock.size(), [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+                flock.Finish(i, sums[i]);
+        });
+    }
+
+private:
+    std::vector<NeighborSums> sums;
+    std::vector<size_t> colors[6];
+    size_t colored_side = 0;
+
+    // Each boid against the 3x3 block around its cell, candidates gathered
+    // once per cell
+    template<typename Agents>
+    void FullStencil(Agents& flock)
+    {
+        const size_t n = grid.cells_per_side;
+        pair_tests = ParallelReduce(0, n*n, size_t(0), [&](size_t begin, size_t end)
+        {
+            std::vector<uint32_t> candidates;
+            size_t tests = 0;
+            for(size_t cell = begin; cell < end; cell++)
+            {
+                if(grid.cell_start[cell] == grid.cell_start[cell + 1]) continue;
+                candidates.clear();
+                grid.ForEachNeighborCell(cell%n, cell/n, flock.periodic, [&](size_t other)
+                {
+                    candidates.insert(candidates.end(), grid.sorted.begin() + grid.cell_start[other], grid.sorted.begin() + grid.cell_start[other + 1]);
+                });
+                for(uint32_t c = grid.cell_start[cell]; c < grid.cell_start[cell + 1]; c++)
+                {
+                    tests += candidates.size() - 1;
+                    flock.Update(grid.sorted[c], candidates.begin(), candidates.end());
+                }
+            }
+            return tests;
+        }, [](size_t a, size_t b) { return a + b; });
+    }
+
+    // Pairs of one cell and its half stencil, returns the distance tests made
+    template<bool Periodic>
+    size_t Cell(const FlockType& flock, size_t cell)
+    {
+        const long n = static_cast<long>(grid.cells_per_side);
+        const long cx = static_cast<long>(cell)%n, cy = static_cast<long>(cell)/n;
+        size_t tests = 0;
+        Pairs<Periodic>(flock, cell, cell, tests);
+        if(n == 1) return tests;
+
+        const long offsets[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+        for(auto& offset: offsets)
+        {
+            long x = cx + offset[0], y = cy + offset[1];
+            if(x < 0 || x >= n || y >= n)
+            {
+                if(!Periodic) continue;
+                x = (x + n)%n;
+                y = y%n;
+            }
+            Pairs<Periodic>(flock, cell, static_cast<size_t>(y*n + x), tests);
+        }
+        return tests;
+    }
+
+    // Every pair between cells a and b, or within a when they are the same
+    template<bool Periodic>
+    void Pairs(const FlockType& flock, size_t cell_a, size_t cell_b, size_t& tests)
+    {
+        const size_t dimension = FlockType::dimension;
+        const float max_dist = flock.Parameters().max_dist;
+        const bool same = cell_a == cell_b;
+        for(uint32_t p = grid.cell_start[cell_a]; p < grid.cell_start[cell_a + 1]; p++)
+        {
+            uint32_t a = grid.sorted[p];
+            float a_location[dimension], a_velocity[dimension];
+            for(size_t d = 0; d < dimension; d++)
+            {
+                a_location[d] = flock.GetLocation(d, a);
+                a_velocity[d] = flock.GetVelocity(d, a);
+            }
+            for(uint32_t q = same ? p + 1 : grid.cell_start[cell_b]; q < grid.cell_start[cell_b + 1]; q++)
+            {
+                uint32_t b = grid.sorted[q];
+                float b_location[dimension], offset[dimension], dist = 0.f;
+                for(size_t d = 0; d < dimension; d++)
+                {
+                    b_location[d] = flock.GetLocation(d, b);
+                    offset[d] = Periodic ? MinimumImage(a_location[d] - b_location[d]) : a_location[d] - b_location[d];
+                    dist += offset[d]*offset[d];
+                }
+                tests++;
+                if(dist > max_dist) continue;
+                float b_velocity[dimension];
+                for(size_t d = 0; d < dimension; d++)
+                    b_velocity[d] = flock.GetVelocity(d, b);
+                FlockType::AddPair(sums[a], sums[b], a_location, b_location, offset, dist, a_velocity, b_velocity);
+            }
+        }
+    }
+};
+
+typedef BasicSymmetricGrid<> SymmetricGrid;
+
+#endif
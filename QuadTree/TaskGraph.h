@@ -0,0 +1,272 @@
+#ifndef TASKGRAPH_H
+#define TASKGRAPH_H
+
+#include "Boid.h"
+#include "Parallel.h"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+
+// Dependency graph of small tasks, run by a pool of workers. A task becomes
+// ready once every task it was added after has finished, so independent
+// chains (one leaf's update, integrate and vertices, say) pipeline past each
+// other instead of meeting at a barrier per phase. Ready tasks are taken
+// newest first, which keeps a worker on the chain it just advanced while that
+// leaf is still in cache.
+class TaskGraph
+{
+public:
+    typedef size_t Task;
+
+    size_t tasks_run = 0;   // Tasks the last Run finished, those added on the way included
+
+    // Adds work that runs after every task in `after`. Can be called from a
+    // running task, so a task can schedule the work it discovers.
+    Task Add(std::function<void()> work, std::initializer_list<Task> after = {})
+    {
+        return Add(std::move(work), after.begin(), after.end());
+    }
+
+    // Same with the dependencies in a vector, for fan in from many tasks
+    Task Add(std::function<void()> work, const std::vector<Task>& after)
+    {
+        return Add(std::move(work), after.data(), after.data() + after.size());
+    }
+
+    size_t size() const { return nodes.size(); }
+
+    // Runs every task, including those added on the way, then empties the
+    // graph. The caller is one of the workers. The first exception a task
+    // throws is rethrown here once the rest have finished.
+    void Run(size_t workers = WorkerCount())
+    {
+        if(InsideParallelFor()) workers = 1;
+        std::vector<std::thread> threads;
+        for(size_t w = 1; w < workers; w++)
+            threads.emplace_back([this]() { Work(); });
+        Work();
+        for(auto& thread: threads)
+            thread.join();
+
+        tasks_run = nodes.size();
+        nodes.clear();
+        finished = 0;
+        if(failure)
+        {
+            std::exception_ptr rethrow = failure;
+            failure = nullptr;
+            std::rethrow_exception(rethrow);
+        }
+    }
+
+private:
+    struct Node
+    {
+        std::function<void()> work;
+        size_t pending = 0;
+        bool done = false;
+        std::vector<Task> dependents;
+    };
+
+    std::deque<Node> nodes;     // Deque so nodes stay put while tasks add more
+    std::vector<Task> ready;
+    size_t finished = 0;
+    std::exception_ptr failure;
+    std::mutex mutex;
+    std::condition_variable wake;
+
+    Task Add(std::function<void()> work, const Task* after_begin, const Task* after_end)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Task task = nodes.size();
+        nodes.emplace_back();
+        Node& node = nodes.back();
+        node.work = std::move(work);
+        for(const Task* dependency = after_begin; dependency != after_end; ++dependency)
+        {
+            if(nodes[*dependency].done) continue;
+            node.pending++;
+            nodes[*dependency].dependents.push_back(task);
+        }
+        if(node.pending == 0)
+        {
+            ready.push_back(task);
+            wake.notify_one();
+        }
+        return task;
+    }
+
+    void Work()
+    {
+        // Tasks are the parallel grain, ParallelFor inside one runs inline
+        bool& inside = InsideParallelFor();
+        bool was_inside = inside;
+        inside = true;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true)
+        {
+            wake.wait(lock, [this]() { return !ready.empty() || finished == nodes.size(); });
+            if(ready.empty()) break;
+            Task task = ready.back();
+            ready.pop_back();
+            std::function<void()> work = std::move(nodes[task].work);
+            lock.unlock();
+            std::exception_ptr thrown;
+            try
+            {
+                work();
+            }
+            catch(...)
+            {
+                thrown = std::current_exception();
+            }
+            lock.lock();
+
+            if(thrown && !failure) failure = thrown;
+
+            Node& node = nodes[task];
+            node.done = true;
+            finished++;
+            for(Task dependent: node.dependents)
+                if(--nodes[dependent].pending == 0) ready.push_back(dependent);
+            if(!ready.empty() || finished == nodes.size()) wake.notify_all();
+        }
+
+        inside = was_inside;
+    }
+};
+
+// One quadtree step of a flock as tasks. The root is cut into
+// tiles_per_side^2 tiles by a parallel counting sort, each tile's subtree is
+// built by its own task, and as soon as a tile is built every leaf in it gets
+// its chain
+//   update -> integrate -> leaf_done (optional, vertex generation say)
+// A leaf's update reads only the boids in that leaf, so it can integrate and
+// draw while other leaves still update and other tiles are still being split.
+// Call ShiftTree first, then graph.Run().
+// tiles is filled with each tile's leaves, together the same leaves base_split
+// gives when every tile holds more than max_size boids. The flock's own Update
+// runs on each leaf, so a rule flock keeps its rules.
+template<typename FlockType>
+void ScheduleStep(TaskGraph& graph, FlockType& flock, std::vector<std::vector<point_bucket> >& tiles, size_t tiles_per_side = 4, size_t max_size = 16, size_t numberOfSeperations = 20, size_t leaves_per_task = 8, std::function<void(const point_bucket&)> leaf_done = nullptr)
+{
+    // Levels of the quadtree the tiles stand for, tiles_per_side rounds up to a power of two
+    size_t levels = 0;
+    while((size_t(1) << levels) < tiles_per_side)
+        levels++;
+    tiles_per_side = size_t(1) << levels;
+    tiles.assign(tiles_per_side*tiles_per_side, std::vector<point_bucket>());
+
+    // Until its task runs, a tile holds just its root box
+    float length = 2.f/tiles_per_side;
+    for(size_t ty = 0; ty < tiles_per_side; ty++)
+        for(size_t tx = 0; tx < tiles_per_side; tx++)
+            tiles[ty*tiles_per_side + tx].emplace_back(-1.f + (tx + 0.5f)*length, -1.f + (ty + 0.5f)*length, length, length);
+
+    // The boids are binned into the tiles by a counting sort spread over
+    // tasks, so no pass over the whole flock runs on one thread: each chunk
+    // of boids counts its tiles, each tile turns the chunk counts into write
+    // positions and sizes its bucket, then each chunk writes its boids into
+    // place. Chunks go in index order, so a tile lists its boids in index
+    // order as a serial pass would.
+    struct Partition
+    {
+        size_t chunk_size = 0;
+        std::unique_ptr<uint32_t[]> tile_of;
+        std::vector<size_t> counts;     // Per chunk and tile, then write positions
+    };
+    const size_t count = flock.size(), tile_count = tiles.size();
+    const size_t chunks = std::max<size_t>(1, std::min(WorkerCount(), count));
+    std::shared_ptr<Partition> partition = std::make_shared<Partition>();
+    partition->chunk_size = (count + chunks - 1)/chunks;
+    partition->tile_of.reset(new uint32_t[count]);
+    partition->counts.assign(chunks*tile_count, 0);
+
+    std::vector<TaskGraph::Task> counted, placed, scattered;
+    for(size_t c = 0; c < chunks; c++)
+        counted.push_back(graph.Add([&flock, partition, c, count, levels, tiles_per_side, tile_count]()
+        {
+            size_t* counts = &partition->counts[c*tile_count];
+            size_t first = std::min(count, c*partition->chunk_size), last = std::min(count, first + partition->chunk_size);
+            for(size_t i = first; i < last; i++)
+            {
+                // Same comparisons against the same box centers as base_split
+                size_t tile[2];
+                for(size_t d = 0; d < 2; d++)
+                {
+                    float val = flock.TreeLocation(d, i), center = 0.f, half = 1.f;
+                    tile[d] = 0;
+                    for(size_t level = 0; level < levels; level++)
+                    {
+                        half /= 2;
+                        bool high = val >= center;
+                        tile[d] = 2*tile[d] + high;
+                        center += high ? half : -half;
+                    }
+                }
+                uint32_t t = static_cast<uint32_t>(tile[1]*tiles_per_side + tile[0]);
+                partition->tile_of[i] = t;
+                counts[t]++;
+            }
+        }));
+    for(size_t t = 0; t < tile_count; t++)
+        placed.push_back(graph.Add([&tiles, partition, t, chunks, tile_count]()
+        {
+            size_t position = 0;
+            for(size_t c = 0; c < chunks; c++)
+            {
+                size_t& slot = partition->counts[c*tile_count + t];
+                size_t boids = slot;
+                slot = position;
+                position += boids;
+            }
+            tiles[t][0].bucket.resize(position);
+        }, counted));
+    for(size_t c = 0; c < chunks; c++)
+        scattered.push_back(graph.Add([&tiles, partition, c, count, tile_count]()
+        {
+            size_t* positions = &partition->counts[c*tile_count];
+            size_t first = std::min(count, c*partition->chunk_size), last = std::min(count, first + partition->chunk_size);
+            for(size_t i = first; i < last; i++)
+            {
+                uint32_t t = partition->tile_of[i];
+                tiles[t][0].bucket[positions[t]++] = i;
+            }
+        }, placed));
+
+    for(size_t t = 0; t < tiles.size(); t++)
+    {
+        graph.Add([&graph, &flock, &tiles, t, max_size, numberOfSeperations, levels, leaves_per_task, leaf_done]()
+        {
+            std::vector<point_bucket>& tree = tiles[t];
+            point_bucket root = std::move(tree[0]);
+            tree.clear();
+            if(root.bucket.empty()) return;
+            if(root.bucket.size() <= max_size || numberOfSeperations <= levels) tree.push_back(std::move(root));
+            else base_split(flock, root, max_size, tree, numberOfSeperations - levels);
+
+            // A leaf's chain has nothing to wait for but itself, so it runs as
+            // one task, and a few leaves share one to keep the overhead small
+            for(size_t begin = 0; begin < tree.size(); begin += leaves_per_task)
+            {
+                size_t end = std::min(tree.size(), begin + leaves_per_task);
+                graph.Add([&flock, &tree, begin, end, leaf_done]()
+                {
+                    for(size_t i = begin; i < end; i++)
+                    {
+                        flock.Update(tree[i].bucket);
+                        flock.Integrate(tree[i].bucket);
+                        if(leaf_done) leaf_done(tree[i]);
+                    }
+                });
+            }
+        }, scattered);
+    }
+}
+
+#endif
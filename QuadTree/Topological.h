@@ -0,0 +1,247 @@
+#ifndef TOPOLOGICAL_H
+#define TOPOLOGICAL_H
+
+#include "Boid.h"
+#include "Grid.h"
+
+// Topological interaction: every boid reacts to its k nearest flockmates,
+// however far away or however crowded, instead of to all within a radius.
+// Starling flocks keep about seven (Ballerini et al. 2008), hence the
+// default k.
+//
+// The kNN query walks rings of grid cells outward from the boid's cell and
+// stops once the next ring cannot hold anything closer than the k-th best.
+// Work per boid is capped at max_candidates distance tests:
+//   - the grid is sized for a few boids per cell on average;
+//   - cells holding more than max_candidates boids are cut into slabs by x,
+//     each sorted by y, and only the boids nearest in y in the boid's slab
+//     and the two beside it are tested.
+// Dense clusters therefore cost the same per boid as sparse ones. The result
+// is exact only for a boid whose search stops on the distance test: once the
+// budget runs out (the last cells scanned are cut short, further rings are
+// skipped), a crowded cell is windowed, or max_rings is reached, it may miss
+// a closer boid. That is the rule in clustered flocks, not the exception.
+class TopologicalNeighbors
+{
+public:
+    static const size_t max_k = 64;
+    size_t k = 7;                   // At most max_k, Build throws past it
+    size_t max_candidates = 64;     // Distance tests per boid
+    size_t max_rings = 8;           // Rings of cells searched past the boid's own
+    float cell_occupancy = 2.f;     // Mean boids per grid cell
+
+    UniformGrid grid;
+    std::vector<uint32_t> neighbors;    // k slots per boid, nearest first
+    std::vector<uint32_t> counts;       // Slots filled for each boid
+    size_t tests = 0;                   // Distance tests of the last Build
+
+    template<typename Storage>
+    void Build(const BasicFlock<Storage>& flock)
+    {
+        if(k > max_k) throw std::runtime_error("TopologicalNeighbors keeps at most 64 neighbours");
+        size_t count = flock.size();
+        neighbors.resize(count*k);
+        counts.resize(count);
+        // No neighbours wanted: every boid has none, nothing to search
+        if(k == 0)
+        {
+            std::fill(counts.begin(), counts.end(), 0u);
+            tests = 0;
+            return;
+        }
+
+        size_t side = static_cast<size_t>(sqrtf(count/std::max(cell_occupancy, 1e-3f)));
+        grid.BuildCells(flock, std::max<size_t>(1, side));
+        SortCrowdedCells(flock);
+
+        // Locations in cell order, so a cell's boids are read contiguously
+        for(size_t d = 0; d < 2; d++)
+            cell_location[d].resize(count);
+        ParallelFor(0, count, [&](size_t begin, size_t end)
+        {
+            for(size_t c = begin; c < end; c++)
+                for(size_t d = 0; d < 2; d++)
+                    cell_location[d][c] = flock.GetLocation(d, grid.sorted[c]);
+        });
+
+        // Boids are queried in cell order, so consecutive queries share cells
+        tests = ParallelReduce(0, count, size_t(0), [&](size_t begin, size_t end)
+        {
+            size_t tested = 0;
+            for(size_t c = begin; c < end; c++)
+                tested += flock.periodic ? Query<true>(flock, grid.sorted[c]) : Query<false>(flock, grid.sorted[c]);
+            return tested;
+        }, [](size_t a, size_t b) { return a + b; });
+    }
+
+    // Accumulates the flock's rules for every boid against its k nearest.
+    // There is no interaction radius, the k are flockmates wherever they are.
+    template<typename FlockType>
+    void Update(FlockType& flock)
+    {
+        Build(flock);
+        ParallelFor(0, flock.size(), [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+                flock.UpdateNeighbors(i, neighbors.begin() + i*k, neighbors.begin() + i*k + counts[i]);
+        });
+    }
+
+private:
+    std::vector<float> cell_location[2];
+    std::vector<float> slab_x;          // Least x of the slab, crowded cells only
+
+    // Boids of a crowded cell per slab, slabs come out about square for a
+    // window of a third of the budget
+    size_t SlabSize(size_t count) const
+    {
+        size_t window = std::max<size_t>(1, max_candidates/3);
+        return std::max(window, static_cast<size_t>(ceilf(sqrtf(static_cast<float>(window*count)))));
+    }
+
+    // Crowded cells are sorted by x, cut into slabs of SlabSize boids, and
+    // each slab sorted by y
+    template<typename Storage>
+    void SortCrowdedCells(const BasicFlock<Storage>& flock)
+    {
+        size_t cells = grid.cell_start.size() - 1;
+        slab_x.resize(grid.sorted.size());
+        ParallelFor(0, cells, [&](size_t begin, size_t end)
+        {
+            for(size_t cell = begin; cell < end; cell++)
+            {
+                size_t first = grid.cell_start[cell], last = grid.cell_start[cell + 1];
+                if(last - first <= max_candidates) continue;
+                auto sorted = grid.sorted.begin();
+                std::sort(sorted + first, sorted + last, [&](uint32_t a, uint32_t b) { return flock.GetLocation(0, a) < flock.GetLocation(0, b); });
+                size_t slab = SlabSize(last - first);
+                for(size_t slab_first = first; slab_first < last; slab_first += slab)
+                {
+                    size_t slab_last = std::min(last, slab_first + slab);
+                    std::fill(slab_x.begin() + slab_first, slab_x.begin() + slab_last, flock.GetLocation(0, grid.sorted[slab_first]));
+                    std::sort(sorted + slab_first, sorted + slab_last, [&](uint32_t a, uint32_t b) { return flock.GetLocation(1, a) < flock.GetLocation(1, b); });
+                }
+            }
+        });
+    }
+
+    // The budget positions of [first, last) nearest to value, which is sorted
+    void Window(const std::vector<float>& sorted, float value, size_t budget, size_t& first, size_t& last) const
+    {
+        if(last - first <= budget) return;
+        size_t centre = static_cast<size_t>(std::lower_bound(sorted.begin() + first, sorted.begin() + last, value) - sorted.begin());
+        first = std::min(std::max(first + budget/2, centre) - budget/2, last - budget);
+        last = first + budget;
+    }
+
+    // Fills boid i's slots, returns the distance tests made
+    template<bool Periodic, typename Storage>
+    size_t Query(const BasicFlock<Storage>& flock, size_t i)
+    {
+        const size_t dimension = BasicFlock<Storage>::dimension;
+        const long n = static_cast<long>(grid.cells_per_side);
+        const float cell_size = 2.f/n;
+        float p[dimension];
+        for(size_t d = 0; d < dimension; d++)
+            p[d] = flock.GetLocation(d, i);
+        const long cx = static_cast<long>(grid.CellCoordinate(p[0])), cy = static_cast<long>(grid.CellCoordinate(p[1]));
+
+        // Distance from the boid to the nearest side of its own cell
+        float lower_x = -1.f + cx*cell_size, lower_y = -1.f + cy*cell_size;
+        float edge = std::min(std::min(p[0] - lower_x, lower_x + cell_size - p[0]), std::min(p[1] - lower_y, lower_y + cell_size - p[1]));
+        edge = std::max(0.f, edge);
+
+        // Best k so far, sorted by distance
+        uint32_t* best = &neighbors[i*k];
+        float best_dist[max_k];
+        const size_t wanted = k;
+        size_t found = 0, tested = 0;
+
+        auto consider = [&](size_t c)
+        {
+            uint32_t j = grid.sorted[c];
+            if(j == i) return;
+            float dist = 0.f;
+            for(size_t d = 0; d < dimension; d++)
+            {
+                float offset = p[d] - cell_location[d][c];
+                if(Periodic) offset = MinimumImage(offset);
+                dist += offset*offset;
+            }
+            tested++;
+            if(found == wanted && dist >= best_dist[found - 1]) return;
+            size_t slot = found < wanted ? found++ : found - 1;
+            while(slot > 0 && best_dist[slot - 1] > dist)
+            {
+                best_dist[slot] = best_dist[slot - 1];
+                best[slot] = best[slot - 1];
+                slot--;
+            }
+            best_dist[slot] = dist;
+            best[slot] = j;
+        };
+
+        auto scan = [&](size_t cell)
+        {
+            size_t first = grid.cell_start[cell], last = grid.cell_start[cell + 1];
+            size_t budget = max_candidates - std::min(max_candidates, tested);
+            if(last - first <= max_candidates)
+            {
+                for(size_t c = first; c < std::min(last, first + budget); c++)
+                    consider(c);
+                return;
+            }
+
+            // Crowded cell: the slab the boid falls in by x and the slabs to
+            // either side, in each the boids nearest in y
+            size_t slab = SlabSize(last - first);
+            size_t position = static_cast<size_t>(std::upper_bound(slab_x.begin() + first, slab_x.begin() + last, p[0]) - slab_x.begin());
+            size_t own = (std::max(position, first + 1) - 1 - first)/slab;
+            size_t lowest = own - std::min<size_t>(own, 1), highest = std::min(own + 1, (last - first - 1)/slab);
+            for(size_t s = lowest; s <= highest; s++)
+            {
+                size_t slab_first = first + s*slab, slab_last = std::min(last, slab_first + slab);
+                Window(cell_location[1], p[1], budget/(highest - lowest + 1), slab_first, slab_last);
+                for(size_t c = slab_first; c < slab_last; c++)
+                    consider(c);
+            }
+        };
+
+        // Rings past (n-1)/2 would wrap onto cells already seen
+        long rings = static_cast<long>(max_rings);
+        if(Periodic) rings = std::min(rings, (n - 1)/2);
+        else rings = std::min(rings, n - 1);
+        for(long r = 0; r <= rings && tested < max_candidates; r++)
+        {
+            // Nothing in ring r is nearer than the own cell's side plus r-1 cells
+            float reach = edge + (r - 1)*cell_size;
+            if(found == wanted && r > 0 && best_dist[found - 1] <= reach*reach) break;
+            for(long dy = -r; dy <= r; dy++)
+            {
+                long y = cy + dy;
+                if(y < 0 || y >= n)
+                {
+                    if(!Periodic) continue;
+                    y = (y + n)%n;
+                }
+                // Whole rows at the top and bottom of the ring, two cells between
+                long step = (dy == -r || dy == r) ? 1 : std::max(1L, 2*r);
+                for(long dx = -r; dx <= r; dx += step)
+                {
+                    long x = cx + dx;
+                    if(x < 0 || x >= n)
+                    {
+                        if(!Periodic) continue;
+                        x = (x + n)%n;
+                    }
+                    scan(static_cast<size_t>(y*n + x));
+                }
+            }
+        }
+
+        counts[i] = static_cast<uint32_t>(found);
+        return tested;
+    }
+};
+
+#endif
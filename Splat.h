@@ -0,0 +1,62 @@
+#ifndef SPLAT_H
+#define SPLAT_H
+
+#include "Camera.h"
+#include "QuadTree/Parallel.h"
+
+// Screen space density/velocity grid used instead of per boid triangles once
+// boids are sub-pixel. Each cell holds (count, sum vx, sum vy).
+class DensitySplat
+{
+public:
+    static const size_t channels = 3;
+
+    size_t width = 0;
+    size_t height = 0;
+    std::vector<float> grid;
+
+    // One cell per `pixels_per_cell` square of screen pixels
+    void Resize(int screen_width, int screen_height, int pixels_per_cell)
+    {
+        size_t new_width = std::max(1, screen_width/pixels_per_cell);
+        size_t new_height = std::max(1, screen_height/pixels_per_cell);
+        if(new_width == width && new_height == height) return;
+        width = new_width;
+        height = new_height;
+        grid.assign(width*height*channels, 0.f);
+    }
+
+    // Bins the boids of the visible leaves through ScatterSums, no atomics.
+    // Source is anything with GetLocation/GetVelocity, a flock or an interpolated view
+    template<typename Source>
+    void Bin(const Source& flock, const std::vector<const point_bucket*>& leaves, const Camera& camera)
+    {
+        float extent = camera.HalfExtent();
+        float to_cell_x = width/(2.f*extent);
+        float to_cell_y = height/(2.f*extent);
+        float left = camera.x - extent;
+        float bottom = camera.y - extent;
+
+        bins.Run(leaves.size(), width*height*channels, grid, [&](float* cells, size_t begin, size_t end)
+        {
+            for(size_t l = begin; l < end; l++)
+            {
+                for(size_t i: leaves[l]->bucket)
+                {
+                    float cx = (flock.GetLocation(0, i) - left)*to_cell_x;
+                    float cy = (flock.GetLocation(1, i) - bottom)*to_cell_y;
+                    if(cx < 0.f || cy < 0.f || cx >= width || cy >= height) continue;
+                    float* cell = &cells[(static_cast<size_t>(cy)*width + static_cast<size_t>(cx))*channels];
+                    cell[0] += 1.f;
+                    cell[1] += flock.GetVelocity(0, i);
+                    cell[2] += flock.GetVelocity(1, i);
+                }
+            }
+        });
+    }
+
+private:
+    ScatterSums<float> bins;
+};
+
+#endif
@@ -0,0 +1,1018 @@
+// Before any header, so windows.h (pulled in by FlowField.h) leaves
+// std::min and std::max alone
+#ifdef _WIN32
+#define NOMINMAX
+#endif
+
+#include "QuadTree/Boid.h"
+#include "QuadTree/Spawn.h"
+#include "QuadTree/NeighborList.h"
+#include "QuadTree/AggregateTree.h"
+#include "QuadTree/MeanField.h"
+#include "QuadTree/ParticleMesh.h"
+#include "QuadTree/Obstacles.h"
+#include "QuadTree/Predators.h"
+#include "QuadTree/FlowField.h"
+#include "QuadTree/Species.h"
+#include "QuadTree/Ensemble.h"
+#include "QuadTree/Domain.h"
+#include "QuadTree/Numa.h"
+#include "QuadTree/TaskGraph.h"
+#include "QuadTree/Rules.h"
+#include "QuadTree/Symmetric.h"
+#include "QuadTree/Topological.h"
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
+// Headless benchmarks, no window or GL context needed.
+// Usage: bench [name] [number_of_boids] [steps]
+
+typedef std::chrono::high_resolution_clock bench_clock;
+
+double TimeSteps(size_t steps, std::function<void(size_t)> step)
+{
+    auto start = bench_clock::now();
+    for(size_t i = 0; i < steps; i++)
+        step(i);
+    return std::chrono::duration<double, std::milli>(bench_clock::now()-start).count()/steps;
+}
+
+template<typename FlockType>
+void StepFlock(FlockType& flock, size_t step)
+{
+    flock.ShiftTree(step);
+    std::vector<point_bucket> tree;
+    point_bucket base(0, 0, 2, 2, flock.size());
+    base_split(flock, base, 16, tree, 20);
+    for(auto& elm: tree)
+        flock.Update(elm.bucket);
+    flock.Integrate();
+}
+
+// StepFlock through the dimension generic tree, leaves updated in parallel
+template<typename FlockType>
+void StepOrthantFlock(FlockType& flock, size_t step)
+{
+    const size_t dimension = FlockType::dimension;
+    flock.ShiftTree(step);
+    std::vector<orthant_bucket<dimension> > tree;
+    orthant_bucket<dimension> base(flock.size());
+    orthant_split(flock, base, 16, tree, 20);
+    ParallelFor(0, tree.size(), [&](size_t begin, size_t end)
+    {
+        for(size_t i = begin; i < end; i++)
+            flock.Update(tree[i].bucket);
+    });
+    flock.Integrate();
+}
+
+// Bounded vs toroidal neighbour search on the same starting flock
+void BenchTorus(size_t number_of_boids, size_t steps)
+{
+    double ms[2];
+    for(int periodic = 0; periodic < 2; periodic++)
+    {
+        Flock flock;
+        flock.periodic = periodic;
+        SpawnFlock(flock, number_of_boids);
+        ms[periodic] = TimeSteps(steps, [&](size_t step) { StepFlock(flock, step); });
+    }
+    std::cout << "torus: bounded " << ms[0] << " ms/step, periodic " << ms[1] << " ms/step ("
+    << 100.0*(ms[1]-ms[0])/ms[0] << "% overhead)\n";
+}
+
+// Root mean square torus distance between the positions of two flocks
+template<typename A, typename B>
+double PositionError(const A& a, const B& b)
+{
+    double sum = 0;
+    for(size_t i = 0; i < a.size(); i++)
+        for(size_t d = 0; d < A::dimension; d++)
+        {
+            double delta = fabs(a.GetLocation(d, i) - b.GetLocation(d, i));
+            if(delta > 1.0) delta = 2.0 - delta;
+            sum += delta*delta;
+        }
+    return sqrt(sum/a.size());
+}
+
+template<typename Storage>
+void RunPrecision(const char* label, size_t number_of_boids, size_t steps)
+{
+    BasicFlock<Storage> flock;
+    Flock reference;
+    SpawnFlock(flock, number_of_boids);
+    SpawnFlock(reference, number_of_boids);
+    // Start the reference from the quantized state so only stepping error is measured
+    for(size_t i = 0; i < number_of_boids; i++)
+        for(size_t d = 0; d < Flock::dimension; d++)
+        {
+            reference.SetLocation(d, i, flock.GetLocation(d, i));
+            reference.SetVelocity(d, i, flock.GetVelocity(d, i));
+        }
+
+    StepFlock(flock, 0);
+    StepFlock(reference, 0);
+    double first_step_error = PositionError(flock, reference);
+
+    double ms = TimeSteps(steps, [&](size_t step) { StepFlock(flock, step + 1); });
+    for(size_t step = 0; step < steps; step++)
+        StepFlock(reference, step + 1);
+
+    size_t bytes = Flock::dimension*(sizeof(typename Storage::location_type) + sizeof(typename Storage::velocity_type) + sizeof(float));
+    std::cout << "precision " << label << ": " << ms << " ms/step, " << bytes << " bytes/boid, rms position error "
+    << first_step_error << " after 1 step, " << PositionError(flock, reference) << " after " << steps + 1 << "\n";
+}
+
+// Full fp32 vs compact location/velocity storage
+void BenchPrecision(size_t number_of_boids, size_t steps)
+{
+    RunPrecision<FloatStorage>("fp32", number_of_boids, steps);
+    RunPrecision<Fixed32Storage>("fixed32+fp16", number_of_boids, steps);
+    RunPrecision<Fixed16Storage>("fixed16+fp16", number_of_boids, steps);
+}
+
+// Verlet list skin vs rebuild interval and throughput. Uses a short
+// interaction radius so radius-exact lists stay a sensible size, and cluster
+// spawns since uniform spawns keep some boids at up to 0.1 per step.
+void BenchVerlet(size_t number_of_boids, size_t steps)
+{
+    const float max_dist = 0.0004f;
+    SpawnConfig config;
+    config.distribution = SpawnDistribution::Clusters;
+    config.cluster_count = 64;
+    config.spread = 0.1f;
+    {
+        Flock flock(max_dist, 0.0005f);
+        SpawnFlock(flock, number_of_boids, config);
+        double ms = TimeSteps(steps, [&](size_t step) { StepFlock(flock, step); });
+        std::cout << "verlet: quadtree leaves " << ms << " ms/step\n";
+    }
+    for(float skin: {0.f, 0.0025f, 0.005f, 0.01f, 0.02f})
+    {
+        Flock flock(max_dist, 0.0005f);
+        SpawnFlock(flock, number_of_boids, config);
+        NeighborList list(skin);
+        double ms = TimeSteps(steps, [&](size_t) { list.Step(flock); flock.Integrate(); });
+        std::cout << "verlet: skin " << skin << " rebuild every " << static_cast<double>(steps)/list.builds << " steps, "
+        << static_cast<double>(list.neighbors.size())/number_of_boids << " neighbours/boid, " << ms << " ms/step\n";
+    }
+}
+
+// Relative RMS difference between two flocks' accelerations
+double AccelerationError(const Flock& a, const Flock& reference)
+{
+    double error = 0, norm = 0;
+    for(size_t i = 0; i < a.size(); i++)
+        for(size_t d = 0; d < Flock::dimension; d++)
+        {
+            double delta = a.acceleration[d][i] - reference.acceleration[d][i];
+            error += delta*delta;
+            norm += reference.acceleration[d][i]*reference.acceleration[d][i];
+        }
+    return norm > 0 ? sqrt(error/norm) : 0;
+}
+
+// Radius exact update through node aggregates, at the default (large) radius.
+// theta 0 opens every node and is the exact reference.
+void BenchAggregate(size_t number_of_boids, size_t steps)
+{
+    Flock start;
+    SpawnFlock(start, number_of_boids);
+    start.ShiftTree(1);
+    Flock reference = start;
+    AggregateTree tree;
+    tree.theta = 0.f;
+    tree.Build(reference);
+    tree.Update(reference);
+
+    for(float theta: {0.f, 0.25f, 0.5f, 1.f, 2.f})
+    {
+        Flock flock;
+        tree.theta = theta;
+        double ms = TimeSteps(steps, [&](size_t)
+        {
+            flock = start;
+            tree.Build(flock);
+            tree.Update(flock);
+        });
+        std::cout << "aggregate: theta " << theta << " " << ms << " ms/update, relative acceleration error "
+        << AccelerationError(flock, reference) << "\n";
+    }
+}
+
+// Summed-area table averages plus short range separation, against the exact
+// radius update. The square query and the shorter separation radius are
+// approximations, so the error is reported alongside the time.
+void BenchMeanField(size_t number_of_boids, size_t steps)
+{
+    Flock start;
+    SpawnFlock(start, number_of_boids);
+    start.ShiftTree(1);
+    Flock reference = start;
+    AggregateTree tree;
+    tree.theta = 0.f;
+    double exact_ms = TimeSteps(steps, [&](size_t)
+    {
+        reference = start;
+        tree.Build(reference);
+        tree.Update(reference);
+    });
+    std::cout << "meanfield: exact " << exact_ms << " ms/update\n";
+
+    MeanFieldGrid grid;
+    for(size_t cells: {4, 8, 16})
+    {
+        Flock flock;
+        grid.cells_per_radius = cells;
+        double ms = TimeSteps(steps, [&](size_t)
+        {
+            flock = start;
+            grid.Build(flock);
+            grid.Update(flock);
+        });
+        std::cout << "meanfield: " << cells << " cells/radius " << ms << " ms/update, relative acceleration error "
+        << AccelerationError(flock, reference) << "\n";
+    }
+}
+
+// Particle mesh against the exact radius update, at the default radius and at
+// a long range one where pair loops blow up
+void BenchParticleMesh(size_t number_of_boids, size_t steps)
+{
+    for(float max_dist: {0.04f, 0.25f})
+    {
+        Flock start(max_dist, 0.0005f);
+        SpawnFlock(start, number_of_boids);
+        start.ShiftTree(1);
+        Flock reference = start;
+        AggregateTree tree;
+        tree.theta = 0.f;
+        double exact_ms = TimeSteps(steps, [&](size_t)
+        {
+            reference = start;
+            tree.Build(reference);
+            tree.Update(reference);
+        });
+        std::cout << "pm: radius " << start.InteractionRadius() << " exact " << exact_ms << " ms/update\n";
+
+        ParticleMesh mesh;
+        for(size_t cells: {128, 256, 512})
+        {
+            Flock flock = start;
+            mesh.cells_per_side = cells;
+            double ms = TimeSteps(steps, [&](size_t)
+            {
+                flock = start;
+                mesh.Build(flock);
+                mesh.Update(flock);
+            });
+            std::cout << "pm: radius " << start.InteractionRadius() << " mesh " << cells << " " << ms
+            << " ms/update, relative acceleration error " << AccelerationError(flock, reference) << "\n";
+        }
+    }
+}
+
+// Hundreds of static obstacles: baked field lookups against testing every
+// boid against every obstacle
+void BenchObstacles(size_t number_of_boids, size_t steps)
+{
+    Flock flock;
+    SpawnFlock(flock, number_of_boids);
+
+    ObstacleField field;
+    uint64_t key = SquaresKey(7);
+    auto draw = [&](uint64_t counter) { return Squares32(counter, key)*(2.f/4294967296.f) - 1.f; };
+    for(uint64_t i = 0; i < 300; i++)
+        field.circles.push_back(CircleObstacle{draw(3*i), draw(3*i + 1), 0.01f + 0.02f*(draw(3*i + 2) + 1.f)});
+    for(uint64_t i = 0; i < 100; i++)
+    {
+        float cx = draw(1000 + 2*i), cy = draw(1001 + 2*i);
+        field.polygons.push_back(PolygonObstacle{{cx - 0.02f, cx + 0.03f, cx}, {cy - 0.02f, cy - 0.01f, cy + 0.03f}});
+    }
+
+    auto start = bench_clock::now();
+    field.Bake(flock.periodic);
+    double bake_ms = std::chrono::duration<double, std::milli>(bench_clock::now()-start).count();
+
+    double field_ms = TimeSteps(steps, [&](size_t) { field.Apply(flock); });
+    double brute_ms = TimeSteps(steps, [&](size_t)
+    {
+        ParallelFor(0, flock.size(), [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; i++)
+                flock.acceleration[0][i] += field.Distance(flock.GetLocation(0, i), flock.GetLocation(1, i), flock.periodic);
+        });
+    });
+
+    double error = 0;
+    for(size_t i = 0; i < flock.size(); i += 97)
+    {
+        float x = flock.GetLocation(0, i), y = flock.GetLocation(1, i);
+        error = std::max(error, (double)fabsf(field.Sample(x, y) - field.Distance(x, y, flock.periodic)));
+    }
+    std::cout << "obstacles: 400 obstacles, bake " << bake_ms << " ms, field " << field_ms << " ms/step, brute force distance "
+    << brute_ms << " ms/step, max sampled distance error " << error << "\n";
+}
+
+// Cost of the predator/prey rules as predators are added, against every prey
+// testing every predator
+void BenchPredators(size_t number_of_boids, size_t steps)
+{
+    Flock prey;
+    SpawnFlock(prey, number_of_boids);
+    for(size_t count: {0, 1000, 4000, 16000})
+    {
+        Predators predators;
+        SpawnConfig config;
+        config.seed = 200;
+        SpawnFlock(predators, count, config);
+        double ms = TimeSteps(steps, [&](size_t) { predators.Update(prey); });
+
+        float radius_squared = predators.flee_radius*predators.flee_radius;
+        double brute_ms = count > 1000 ? 0 : TimeSteps(1, [&](size_t)
+        {
+            ParallelFor(0, prey.size(), [&](size_t begin, size_t end)
+            {
+                for(size_t i = begin; i < end; i++)
+                    for(size_t j = 0; j < count; j++)
+                    {
+                        float dx = MinimumImage(prey.GetLocation(0, i) - predators.location[0][j]);
+                        float dy = MinimumImage(prey.GetLocation(1, i) - predators.location[1][j]);
+                        if(dx*dx + dy*dy <= radius_squared) prey.acceleration[0][i] += dx;
+                    }
+            });
+        });
+        std::cout << "predators: " << count << " predators " << ms << " ms/step";
+        if(brute_ms > 0) std::cout << ", all pairs " << brute_ms << " ms/step";
+        std::cout << "\n";
+    }
+}
+
+// Flow forcing streamed from a memory mapped file, a quarter frame per step so
+// the prefetcher has to keep up with new frames
+void BenchFlow(size_t number_of_boids, size_t steps)
+{
+    const uint32_t side = 1024, frames = 16;
+    std::string path = "bench_flow.bin";
+    WriteFlowFile(path, side, side, frames, [](uint32_t f, uint32_t x, uint32_t y, float (&uv)[2])
+    {
+        float phase = 6.2831853f*(x + 7.f*f)/side;
+        uv[0] = 0.005f*sinf(phase + 6.2831853f*y/side);
+        uv[1] = 0.005f*cosf(phase);
+    });
+
+    Flock flock;
+    SpawnFlock(flock, number_of_boids);
+    {
+        FlowField flow(path);
+        double ms = TimeSteps(steps, [&](size_t step) { flow.Apply(flock, 0.25*step); });
+        std::cout << "flow: " << side << "^2 x " << frames << " frames, " << ms << " ms/step\n";
+        // Jumping 3 frames a step never makes the prefetched frame current,
+        // it still has to be dropped
+        size_t most_resident = 0;
+        for(size_t step = 0; step < 2*frames; step++)
+        {
+            flow.Apply(flock, 3.0*step);
+            most_resident = std::max(most_resident, flow.ResidentFrames());
+        }
+        std::cout << "flow: jumping 3 frames a step, at most " << most_resident << " frames resident\n";
+    }
+    std::remove(path.c_str());
+}
+
+// One species against the exact update as a check, then the same boids split
+// into three species with their own radii and a sparse interaction matrix
+void BenchSpecies(size_t number_of_boids, size_t steps)
+{
+    Flock reference;
+    SpawnFlock(reference, number_of_boids);
+    SpeciesFlock single;
+    single.AddSpecies(SpeciesParameters());
+    single.species[0] = reference;
+    AggregateTree tree;
+    tree.theta = 0.f;
+    tree.Build(reference);
+    tree.Update(reference);
+    double ms = TimeSteps(1, [&](size_t) { single.Update(); });
+    std::cout << "species: 1 species " << ms << " ms/update, relative acceleration error against exact "
+    << AccelerationError(single.species[0], reference) << "\n";
+
+    SpeciesFlock mixed;
+    float radii[3] = {0.04f, 0.01f, 0.09f};
+    for(size_t s = 0; s < 3; s++)
+    {
+        SpeciesParameters parameters;
+        parameters.max_dist = radii[s];
+        size_t id = mixed.AddSpecies(parameters);
+        SpawnConfig config;
+        config.seed = 100 + s;
+        SpawnFlock(mixed.species[id], number_of_boids/3, config);
+    }
+    mixed.Interaction(1, 0).seperation = 4.f;   // Species 1 keeps well clear of 0
+    mixed.Interaction(2, 1).flocking = 0.5f;    // Species 2 half follows 1
+    mixed.Interaction(0, 2).seperation = 0.f;   // Species 0 ignores 2
+    ms = TimeSteps(steps, [&](size_t)
+    {
+        mixed.Update();
+        mixed.Integrate();
+    });
+    std::cout << "species: 3 species " << ms << " ms/step\n";
+}
+
+// Octree flock on the 3D torus next to the same number of boids in the plane
+void Bench3D(size_t number_of_boids, size_t steps)
+{
+    Flock flat;
+    SpawnFlock(flat, number_of_boids);
+    double flat_ms = TimeSteps(steps, [&](size_t step) { StepOrthantFlock(flat, step); });
+
+    Flock3D flock;
+    SpawnFlock(flock, number_of_boids);
+    double ms = TimeSteps(steps, [&](size_t step) { StepOrthantFlock(flock, step); });
+    std::cout << "3d: " << number_of_boids << " boids, 2D quadtree " << flat_ms << " ms/step, 3D octree " << ms << " ms/step\n";
+}
+
+// Parameter sweep of small flocks: the batch runner against constructing a
+// fresh flock per run and parallelising inside it
+void BenchEnsemble(size_t number_of_boids, size_t steps)
+{
+    std::vector<EnsembleRun> runs;
+    for(size_t r = 0; r < 32; r++)
+    {
+        EnsembleRun run;
+        run.parameters.max_dist = 0.0004f*(1 + r%4);
+        run.spawn.seed = 100 + r;
+        run.boids = number_of_boids;
+        run.steps = steps;
+        runs.push_back(run);
+    }
+
+    double fresh_ms = TimeSteps(1, [&](size_t)
+    {
+        for(auto& run: runs)
+        {
+            Flock flock;
+            flock.SetParameters(run.parameters);
+            SpawnFlock(flock, run.boids, run.spawn);
+            NeighborList neighbors(0.25f*flock.InteractionRadius());
+            for(size_t step = 0; step < run.steps; step++)
+            {
+                neighbors.Step(flock);
+                flock.Integrate();
+            }
+        }
+    });
+
+    EnsembleRunner runner;
+    float polarization = 0.f;
+    double batch_ms = TimeSteps(1, [&](size_t)
+    {
+        runner.Run(runs, [&](const EnsembleSummary& summary) { polarization += summary.polarization; });
+    });
+    std::cout << "ensemble: " << runs.size() << " runs of " << number_of_boids << " boids x " << steps << " steps, fresh flocks "
+    << fresh_ms << " ms, batch runner " << batch_ms << " ms, mean polarization " << polarization/runs.size() << "\n";
+}
+
+// The flock split over 2x2 forked processes talking through shared memory.
+// Every rank reports its own boids, halo and time per step.
+void BenchDomain(size_t number_of_boids, size_t steps)
+{
+#ifndef _WIN32
+    const size_t tiles_x = 2, tiles_y = 2, ranks = tiles_x*tiles_y;
+    const std::string name = "/flock_bench_domain";
+    ShmTransport::Create(name, ranks, 4*number_of_boids);
+    std::vector<pid_t> children;
+    for(size_t rank = 0; rank < ranks; rank++)
+    {
+        pid_t pid = fork();
+        if(pid == 0)
+        {
+            ShmTransport transport(name, rank);
+            DomainFlock domain(transport, tiles_x, tiles_y);
+            domain.Spawn(number_of_boids);
+            double ms = TimeSteps(steps, [&](size_t) { domain.Step(); });
+            std::cout << "domain: rank " << rank << " owns " << domain.flock.size() << " boids, halo " << domain.HaloCount()
+            << ", " << ms << " ms/step\n" << std::flush;
+            _exit(0);
+        }
+        children.push_back(pid);
+    }
+    for(pid_t pid: children)
+        waitpid(pid, nullptr, 0);
+    ShmTransport::Remove(name);
+
+    Flock flock;
+    SpawnFlock(flock, number_of_boids);
+    UniformGrid grid;
+    double ms = TimeSteps(steps, [&](size_t)
+    {
+        grid.Build(flock, flock.InteractionRadius());
+        std::vector<uint32_t> candidates;
+        for(size_t i = 0; i < flock.size(); i++)
+        {
+            candidates.clear();
+            grid.ForEachNeighborCell(grid.CellCoordinate(flock.GetLocation(0, i)), grid.CellCoordinate(flock.GetLocation(1, i)), flock.periodic, [&](size_t cell)
+            {
+                candidates.insert(candidates.end(), grid.sorted.begin() + grid.cell_start[cell], grid.sorted.begin() + grid.cell_start[cell + 1]);
+            });
+            flock.Update(i, candidates.begin(), candidates.end());
+        }
+        flock.Integrate();
+    });
+    std::cout << "domain: single process " << ms << " ms/step\n";
+#endif
+}
+
+// Share of each worker chunk's location pages that sit on the node the
+// worker runs on, sampled one page in every 4 KiB
+template<typename Storage>
+double LocalPageFraction(const BasicFlock<Storage>& flock)
+{
+    const size_t stride = 4096/sizeof(typename Storage::location_type);
+    size_t local = 0, sampled = 0;
+    std::mutex mutex;
+    ParallelFor(0, flock.size(), [&](size_t begin, size_t end)
+    {
+        int node = CurrentNode();
+        size_t chunk_local = 0, chunk_sampled = 0;
+        for(size_t i = begin; i < end; i += stride)
+        {
+            int page_node = NodeOfAddress(&flock.location[0][i]);
+            if(page_node < 0) continue;
+            chunk_sampled++;
+            chunk_local += page_node == node;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        local += chunk_local;
+        sampled += chunk_sampled;
+    });
+    return sampled ? static_cast<double>(local)/sampled : -1;
+}
+
+// Verlet steps on a flock written first by the main thread vs one placed by
+// the pinned workers and sorted so each worker owns a region of the plane
+void BenchNuma(size_t number_of_boids, size_t steps)
+{
+    const float max_dist = 0.0004f;
+    {
+        Flock flock(max_dist, 0.0005f);
+        SpawnFlock(flock, number_of_boids);
+        NeighborList list(0.25f*flock.InteractionRadius());
+        double ms = TimeSteps(steps, [&](size_t) { list.Step(flock); flock.Integrate(); });
+        std::cout << "numa: serial first touch " << ms << " ms/step, local pages " << LocalPageFraction(flock) << "\n";
+    }
+    {
+        bool was_pinned = PinWorkers();
+        PinWorkers() = true;
+        PlacedFlock flock(max_dist, 0.0005f);
+        SpawnFlock(flock, number_of_boids);
+        SortSpatially(flock);
+        NeighborList list(0.25f*flock.InteractionRadius());
+        double ms = TimeSteps(steps, [&](size_t) { list.Step(flock); flock.Integrate(); });
+        std::cout << "numa: pinned, sorted, parallel first touch " << ms << " ms/step, local pages " << LocalPageFraction(flock) << "\n";
+        PinWorkers() = was_pinned;
+    }
+}
+
+// Triangles of one leaf's boids, as main.cpp draws them, at each boid's own slot
+void LeafVertices(const Flock& flock, const point_bucket& leaf, std::vector<float>& vertices)
+{
+    const float scale = 1.f/900.f;
+    for(size_t i: leaf.bucket)
+    {
+        float x = flock.GetLocation(0, i), y = flock.GetLocation(1, i);
+        float direction[2] = {flock.GetVelocity(0, i), flock.GetVelocity(1, i)};
+        NormalizeVectorInPlace(direction, scale);
+        float* out = &vertices[9*i];
+        out[0] = x - direction[1]; out[1] = y + direction[0];
+        out[3] = x + direction[1]; out[4] = y - direction[0];
+        out[6] = x + 4*direction[0]; out[7] = y + 4*direction[1];
+    }
+}
+
+// A frame as phases with a barrier between each (build, update, integrate,
+// vertices) vs the same work as a task graph pipelined per leaf. The
+// clustered spawn packs boids tighter than the tree's depth, so its leaves
+// are cut off at the depth limit and must still hold every boid.
+void BenchTaskGraph(size_t number_of_boids, size_t steps)
+{
+    SpawnConfig uniform, clustered;
+    clustered.distribution = SpawnDistribution::Clusters;
+    clustered.cluster_count = 256;
+    clustered.spread = 1e-7f;
+    const std::pair<const char*, SpawnConfig> spawns[] = {{"uniform", uniform}, {"clustered", clustered}};
+    for(auto& spawn: spawns)
+    {
+        Flock start;
+        SpawnFlock(start, number_of_boids, spawn.second);
+        std::vector<float> vertices(9*number_of_boids, 0.f);
+
+        Flock phased = start;
+        double phased_ms = TimeSteps(steps, [&](size_t step)
+        {
+            phased.ShiftTree(step);
+            std::vector<point_bucket> tree;
+            point_bucket base(0, 0, 2, 2, phased.size());
+            base_split(phased, base, 16, tree, 20);
+            ParallelFor(0, tree.size(), [&](size_t begin, size_t end)
+            {
+                for(size_t i = begin; i < end; i++)
+                    phased.Update(tree[i].bucket);
+            });
+            phased.Integrate();
+            ParallelFor(0, tree.size(), [&](size_t begin, size_t end)
+            {
+                for(size_t i = begin; i < end; i++)
+                    LeafVertices(phased, tree[i], vertices);
+            });
+        });
+
+        Flock graphed = start;
+        TaskGraph graph;
+        std::vector<std::vector<point_bucket> > tiles;
+        size_t tasks = 0;
+        double graph_ms = TimeSteps(steps, [&](size_t step)
+        {
+            graphed.ShiftTree(step);
+            ScheduleStep(graph, graphed, tiles, 4, 16, 20, 8, [&](const point_bucket& leaf) { LeafVertices(graphed, leaf, vertices); });
+            graph.Run();
+            tasks = graph.tasks_run;
+        });
+
+        // Same leaves in a different order sum in a different order, so compare
+        // one frame from the start (later frames drift apart chaotically)
+        phased = start;
+        graphed = start;
+        std::vector<point_bucket> tree;
+        point_bucket base(0, 0, 2, 2, phased.size());
+        base_split(phased, base, 16, tree, 20);
+        for(auto& elm: tree)
+            phased.Update(elm.bucket);
+        phased.Integrate();
+        ScheduleStep(graph, graphed, tiles);
+        graph.Run();
+
+        size_t in_leaves = 0, unmoved = 0;
+        for(auto& tile: tiles)
+            for(auto& leaf: tile)
+                in_leaves += leaf.bucket.size();
+        float difference = 0.f;
+        for(size_t i = 0; i < number_of_boids; i++)
+        {
+            bool moved = false;
+            for(size_t d = 0; d < Flock::dimension; d++)
+            {
+                difference = std::max(difference, fabsf(MinimumImage(phased.GetLocation(d, i) - graphed.GetLocation(d, i))));
+                moved |= graphed.GetLocation(d, i) != start.GetLocation(d, i);
+            }
+            unmoved += !moved;
+        }
+        std::cout << "taskgraph: " << spawn.first << ", phased " << phased_ms << " ms/frame, task graph " << graph_ms << " ms/frame ("
+        << tasks << " tasks, " << WorkerCount() << " workers), " << in_leaves << " of " << number_of_boids << " boids in leaves, "
+        << unmoved << " unmoved, max location difference after one frame " << difference << "\n";
+    }
+}
+
+// Quadtree update of every leaf, without integrating
+template<typename FlockType>
+void UpdateLeaves(FlockType& flock)
+{
+    flock.ShiftTree(1);
+    std::vector<point_bucket> tree;
+    point_bucket base(0, 0, 2, 2, flock.size());
+    base_split(flock, base, 16, tree, 20);
+    for(auto& elm: tree)
+        flock.Update(elm.bucket);
+}
+
+// One step from the same start through an index, for the built in flock, the
+// same three rules composed (should agree) and those plus a goal (should not,
+// unless the index quietly runs the built in rules on a rule flock)
+template<typename Step>
+void CompareRulePaths(const char* label, const Flock& start, Step step)
+{
+    Flock builtin = start;
+    ClassicRuleFlock classic;
+    static_cast<Flock&>(classic) = start;
+    RuleFlock<SeperationRule, AlignmentRule, CohesionRule, GoalRule> goal;
+    static_cast<Flock&>(goal) = start;
+    step(builtin);
+    step(classic);
+    step(goal);
+    std::cout << "rules: through " << label << ", composed rms position difference " << PositionError(classic, builtin)
+    << ", with a goal " << PositionError(goal, builtin) << "\n";
+}
+
+// The built in rules vs the same three composed from policies, and the cost
+// of two extra per boid rules on top
+void BenchRules(size_t number_of_boids, size_t steps)
+{
+    Flock start;
+    SpawnFlock(start, number_of_boids);
+
+    Flock reference = start;
+    reference.small_leaf_kernels = false;
+    ClassicRuleFlock classic;
+    static_cast<Flock&>(classic) = start;
+    UpdateLeaves(reference);
+    UpdateLeaves(classic);
+    double error = AccelerationError(classic, reference);
+
+    Flock flock = start;
+    double builtin_ms = TimeSteps(steps, [&](size_t step) { StepFlock(flock, step); });
+    static_cast<Flock&>(classic) = start;
+    double classic_ms = TimeSteps(steps, [&](size_t step) { StepFlock(classic, step); });
+    RuleFlock<SeperationRule, AlignmentRule, CohesionRule, GoalRule, SpeedRule> extended;
+    static_cast<Flock&>(extended) = start;
+    double extended_ms = TimeSteps(steps, [&](size_t step) { StepFlock(extended, step); });
+
+    std::cout << "rules: built in " << builtin_ms << " ms/step, composed " << classic_ms << " ms/step (relative acceleration error "
+    << error << "), with goal and speed " << extended_ms << " ms/step\n";
+
+    // Every index has to reach the rule flock's own Update
+    CompareRulePaths("task graph", start, [](auto& flock)
+    {
+        TaskGraph graph;
+        std::vector<std::vector<point_bucket> > tiles;
+        flock.ShiftTree(1);
+        ScheduleStep(graph, flock, tiles);
+        graph.Run();
+    });
+    CompareRulePaths("neighbour list", start, [](auto& flock)
+    {
+        NeighborList list(0.01f);
+        list.Step(flock);
+        flock.Integrate();
+    });
+    CompareRulePaths("aggregate tree", start, [](auto& flock)
+    {
+        AggregateTree tree;
+        tree.theta = 0.f;
+        tree.Build(flock);
+        tree.Update(flock);
+        flock.Integrate();
+    });
+    CompareRulePaths("symmetric grid", start, [](auto& flock)
+    {
+        SymmetricGrid grid;
+        grid.Update(flock);
+        flock.Integrate();
+    });
+    CompareRulePaths("k nearest", start, [](auto& flock)
+    {
+        TopologicalNeighbors knn;
+        knn.Update(flock);
+        flock.Integrate();
+    });
+}
+
+// Generic leaf loop vs the fixed size pair matrix kernels, at the max_size
+// main.cpp uses and at 32
+void BenchLeafKernels(size_t number_of_boids, size_t steps)
+{
+    Flock start;
+    SpawnFlock(start, number_of_boids);
+    for(size_t max_size: {16, 32})
+    {
+        double ms[2];
+        Flock updated[2];
+        for(int kernels = 0; kernels < 2; kernels++)
+        {
+            Flock& flock = updated[kernels];
+            flock = start;
+            flock.small_leaf_kernels = kernels;
+            flock.ShiftTree(1);
+            std::vector<point_bucket> tree;
+            point_bucket base(0, 0, 2, 2, flock.size());
+            base_split(flock, base, max_size, tree, 20);
+            ms[kernels] = TimeSteps(steps, [&](size_t)
+            {
+                for(size_t d = 0; d < Flock::dimension; d++)
+                    std::fill(flock.acceleration[d].begin(), flock.acceleration[d].end(), 0.f);
+                for(auto& elm: tree)
+                    flock.Update(elm.bucket);
+            });
+        }
+        std::cout << "leafkernels: max_size " << max_size << " generic " << ms[0] << " ms/update, kernels " << ms[1]
+        << " ms/update, relative acceleration error " << AccelerationError(updated[1], updated[0]) << "\n";
+    }
+}
+
+// Each pair once instead of twice: quadtree leaves past the small kernels,
+// then the radius exact grid update against the full 3x3 stencil
+void BenchSymmetric(size_t number_of_boids, size_t steps)
+{
+    Flock start;
+    SpawnFlock(start, number_of_boids);
+    {
+        double ms[2];
+        Flock updated[2];
+        for(int symmetric = 0; symmetric < 2; symmetric++)
+        {
+            Flock& flock = updated[symmetric];
+            flock = start;
+            flock.small_leaf_kernels = false;
+            flock.symmetric_pairs = symmetric;
+            flock.ShiftTree(1);
+            std::vector<point_bucket> tree;
+            point_bucket base(0, 0, 2, 2, flock.size());
+            base_split(flock, base, 64, tree, 20);
+            ms[symmetric] = TimeSteps(steps, [&](size_t)
+            {
+                for(size_t d = 0; d < Flock::dimension; d++)
+                    std::fill(flock.acceleration[d].begin(), flock.acceleration[d].end(), 0.f);
+                ParallelFor(0, tree.size(), [&](size_t begin, size_t end)
+                {
+                    for(size_t i = begin; i < end; i++)
+                        flock.Update(tree[i].bucket);
+                });
+            });
+        }
+        std::cout << "symmetric: leaves of up to 64, both ways " << ms[0] << " ms/update, once " << ms[1]
+        << " ms/update, relative acceleration error " << AccelerationError(updated[1], updated[0]) << "\n";
+    }
+
+    const float max_dist = 0.0004f;
+    Flock reference(max_dist, 0.0005f), flock(max_dist, 0.0005f);
+    SpawnFlock(reference, number_of_boids);
+    SpawnFlock(flock, number_of_boids);
+    UniformGrid grid;
+    size_t full_tests = 0;
+    double full_ms = TimeSteps(steps, [&](size_t)
+    {
+        for(size_t d = 0; d < Flock::dimension; d++)
+            std::fill(reference.acceleration[d].begin(), reference.acceleration[d].end(), 0.f);
+        grid.Build(reference, reference.InteractionRadius());
+        full_tests = ParallelReduce(0, reference.size(), size_t(0), [&](size_t begin, size_t end)
+        {
+            std::vector<uint32_t> candidates;
+            size_t tests = 0;
+            for(size_t i = begin; i < end; i++)
+            {
+                candidates.clear();
+                grid.ForEachNeighborCell(grid.CellCoordinate(reference.GetLocation(0, i)), grid.CellCoordinate(reference.GetLocation(1, i)), reference.periodic, [&](size_t cell)
+                {
+                    candidates.insert(candidates.end(), grid.sorted.begin() + grid.cell_start[cell], grid.sorted.begin() + grid.cell_start[cell + 1]);
+                });
+                tests += candidates.size() - 1;
+                reference.Update(i, candidates.begin(), candidates.end());
+            }
+            return tests;
+        }, [](size_t a, size_t b) { return a + b; });
+    });
+    SymmetricGrid symmetric;
+    double symmetric_ms = TimeSteps(steps, [&](size_t)
+    {
+        for(size_t d = 0; d < Flock::dimension; d++)
+            std::fill(flock.acceleration[d].begin(), flock.acceleration[d].end(), 0.f);
+        symmetric.Update(flock);
+    });
+    std::cout << "symmetric: grid, full stencil " << full_ms << " ms/update (" << full_tests << " tests), coloured half stencil "
+    << symmetric_ms << " ms/update (" << symmetric.pair_tests << " tests), relative acceleration error " << AccelerationError(flock, reference) << "\n";
+}
+
+// Fraction of the true k nearest, found by brute force, that knn reported,
+// over a sample of boids
+double NeighborRecall(const Flock& flock, const TopologicalNeighbors& knn, size_t samples)
+{
+    size_t hits = 0, wanted = 0;
+    for(size_t s = 0; s < samples; s++)
+    {
+        size_t i = s*flock.size()/samples;
+        std::vector<std::pair<float, uint32_t> > all;
+        for(size_t j = 0; j < flock.size(); j++)
+        {
+            if(j == i) continue;
+            float dist = 0.f;
+            for(size_t d = 0; d < Flock::dimension; d++)
+            {
+                float offset = MinimumImage(flock.GetLocation(d, i) - flock.GetLocation(d, j));
+                dist += offset*offset;
+            }
+            all.emplace_back(dist, static_cast<uint32_t>(j));
+        }
+        size_t k = std::min(knn.k, all.size());
+        std::partial_sort(all.begin(), all.begin() + k, all.end());
+        for(size_t slot = 0; slot < knn.counts[i]; slot++)
+        {
+            float dist = 0.f;
+            for(size_t d = 0; d < Flock::dimension; d++)
+            {
+                float offset = MinimumImage(flock.GetLocation(d, i) - flock.GetLocation(d, knn.neighbors[i*knn.k + slot]));
+                dist += offset*offset;
+            }
+            hits += dist <= all[k - 1].first;
+        }
+        wanted += k;
+    }
+    return static_cast<double>(hits)/wanted;
+}
+
+void BenchTopological(size_t number_of_boids, size_t steps)
+{
+    // Tight clusters, and clusters so tight the quadtree runs out of depth.
+    // Out of depth leaves are kept whole, so the radius baseline there
+    // updates every boid, with thousands in one leaf.
+    SpawnConfig uniform, tight, collapsed;
+    tight.distribution = collapsed.distribution = SpawnDistribution::Clusters;
+    tight.spread = 1e-4f;
+    collapsed.spread = 1e-7f;
+    const std::pair<const char*, SpawnConfig> spawns[] = {{"uniform", uniform}, {"tight clusters", tight}, {"collapsed clusters", collapsed}};
+    for(auto& spawn: spawns)
+    {
+        Flock metric, topological;
+        SpawnFlock(metric, number_of_boids, spawn.second);
+        SpawnFlock(topological, number_of_boids, spawn.second);
+
+        size_t max_leaf = 0;
+        double metric_ms = TimeSteps(steps, [&](size_t step)
+        {
+            metric.ShiftTree(step);
+            std::vector<point_bucket> tree;
+            point_bucket base(0, 0, 2, 2, metric.size());
+            base_split(metric, base, 16, tree, 20);
+            for(auto& leaf: tree)
+                max_leaf = std::max(max_leaf, leaf.bucket.size());
+            ParallelFor(0, tree.size(), [&](size_t begin, size_t end)
+            {
+                for(size_t i = begin; i < end; i++)
+                    metric.Update(tree[i].bucket);
+            });
+            metric.Integrate();
+        });
+
+        TopologicalNeighbors knn;
+        double topological_ms = TimeSteps(steps, [&](size_t)
+        {
+            knn.Update(topological);
+            topological.Integrate();
+        });
+        knn.Build(topological);
+
+        std::cout << "knn: " << spawn.first << ", quadtree radius " << metric_ms << " ms/step (largest leaf " << max_leaf
+        << "), k = " << knn.k << " nearest " << topological_ms << " ms/step (" << static_cast<double>(knn.tests)/topological.size()
+        << " tests/boid, recall " << NeighborRecall(topological, knn, 256) << ")\n";
+    }
+
+    // Edge cases: no neighbours leaves every boid alone, too many is refused
+    Flock flock;
+    SpawnFlock(flock, number_of_boids);
+    TopologicalNeighbors knn;
+    knn.k = 0;
+    knn.Update(flock);
+    size_t filled = 0, moved = 0;
+    for(size_t i = 0; i < flock.size(); i++)
+    {
+        filled += knn.counts[i];
+        moved += flock.acceleration[0][i] != 0.f || flock.acceleration[1][i] != 0.f;
+    }
+    bool refused = false;
+    knn.k = TopologicalNeighbors::max_k + 1;
+    try { knn.Build(flock); } catch(const std::runtime_error&) { refused = true; }
+    std::cout << "knn: k = 0 fills " << filled << " slots, " << moved << " boids accelerated; k = " << knn.k
+    << (refused ? " refused" : " accepted") << "\n";
+}
+
+int main(int argc, char** argv)
+{
+    std::string name = argc > 1 ? argv[1] : "all";
+    size_t number_of_boids = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : (size_t)1 << 16;
+    size_t steps = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 100;
+
+    std::vector<std::pair<std::string, std::function<void(size_t, size_t)> > > benches = {
+        {"torus", BenchTorus},
+        {"precision", BenchPrecision},
+        {"verlet", BenchVerlet},
+        {"aggregate", BenchAggregate},
+        {"meanfield", BenchMeanField},
+        {"pm", BenchParticleMesh},
+        {"obstacles", BenchObstacles},
+        {"predators", BenchPredators},
+        {"flow", BenchFlow},
+        {"species", BenchSpecies},
+        {"3d", Bench3D},
+        {"ensemble", BenchEnsemble},
+        {"domain", BenchDomain},
+        {"numa", BenchNuma},
+        {"taskgraph", BenchTaskGraph},
+        {"rules", BenchRules},
+        {"leafkernels", BenchLeafKernels},
+        {"symmetric", BenchSymmetric},
+        {"knn", BenchTopological},
+    };
+
+    for(auto& bench: benches)
+        if(name == "all" || name == bench.first)
+            bench.second(number_of_boids, steps);
+    return 0;
+}
@@ -1,8 +1,14 @@
 #include "glad/glad.h"
 #include "GLFW/glfw3.h"
 #include "QuadTree/Boid.h"
+#include "QuadTree/Spawn.h"
+#include "QuadTree/TaskGraph.h"
+#include "Camera.h"
+#include "Splat.h"
+#include "Pipeline.h"
 #include <cstdlib>
 #include <exception>
+#include <iterator>
 #include <iostream>
 #include <fstream>
 #include <random>
@@ -10,14 +16,17 @@
 #include <vector>
 #include <math.h>
 #include <chrono>
+#include <thread>
 
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void processInput(GLFWwindow* window);
+void scroll_callback(GLFWwindow* window, double x_offset, double y_offset);
+void window_size_callback(GLFWwindow* window, int width, int height);
 unsigned int init_GL_Shader(std::string filePath, GLenum shaderType);
 unsigned int init_GL_Program(std::vector<unsigned int> shaders);
 void updateBuffer(uint &id, uint offset, void *data, uint size, GLenum shaderType);
-void updateVertices(std::vector<Boid>& flock, GLFWwindow* window, std::vector<float>& vertices);
+size_t updateVertices(const InterpolatedView& flock, const std::vector<const point_bucket*>& leaves, const Camera& camera, std::vector<float>& vertices);
 class GLFW_Wrapper
 {
 public:
@@ -69,6 +78,12 @@ int main()
 
     GLFWwindow* window = glfw.window;
 
+    Camera camera;
+    glfwGetWindowSize(window, &camera.width, &camera.height);
+    glfwSetWindowUserPointer(window, &camera);
+    glfwSetScrollCallback(window, scroll_callback);
+    glfwSetWindowSizeCallback(window, window_size_callback);
+
     Flock flock;
 
     //DECLARE DRAW SIZE AND TOTAL NUMBER OF BOIDS
@@ -76,17 +91,21 @@ int main()
     //Found that 2^15 boids is max can be drawn at once?
     size_t draw_size = 3*(number_of_boids);
 
-    std::srand(100);
-    for(size_t i = 0; i < number_of_boids; i++)
-        flock.boids.emplace_back(std::vector<float>{(static_cast<float>(std::rand())/(static_cast<float>(RAND_MAX)/2))-1, (static_cast<float>(std::rand())/(static_cast<float>(RAND_MAX)/2))-1},
-                                 std::vector<float>{(static_cast<float>(std::rand())/(static_cast<float>(RAND_MAX)/2))-1, (static_cast<float>(std::rand())/(static_cast<float>(RAND_MAX)/2))-1});
+    SpawnConfig spawn_config;
+    spawn_config.distribution = SpawnDistribution::Uniform;
+    spawn_config.seed = 100;
+    SpawnFlock(flock, number_of_boids, spawn_config);
 
     unsigned int vertexShader, fragmentShader, shaderProgram;
+    unsigned int splatVertexShader, splatFragmentShader, splatProgram;
 
     try {
         vertexShader = init_GL_Shader("GLSL/V1.glsl", GL_VERTEX_SHADER);
         fragmentShader = init_GL_Shader("GLSL/F1.glsl", GL_FRAGMENT_SHADER);
         shaderProgram = init_GL_Program(std::vector<unsigned int>{vertexShader, fragmentShader});
+        splatVertexShader = init_GL_Shader("GLSL/V2.glsl", GL_VERTEX_SHADER);
+        splatFragmentShader = init_GL_Shader("GLSL/F2.glsl", GL_FRAGMENT_SHADER);
+        splatProgram = init_GL_Program(std::vector<unsigned int>{splatVertexShader, splatFragmentShader});
     } catch (std::runtime_error e) {
         std::cerr << e.what() << std::endl;
         return -1;
@@ -94,7 +113,7 @@ int main()
 
 
 
-    std::vector<float> vertices(flock.boids.size()*9, 0.f);
+    std::vector<float> vertices(flock.size()*9, 0.f);
 
     unsigned int VAO, VBO;
     glGenVertexArrays(1, &VAO);
@@ -112,73 +131,186 @@ int main()
 
     glBindVertexArray(0);
 
-    float FPS_sum = 0;
-    size_t frames = 0;
-    float CPS_sum = 0;
-    std::chrono::high_resolution_clock::time_point start;
+    int view_location = glGetUniformLocation(shaderProgram, "view");
+
+    // Density splat LOD, a full screen quad textured with the binned flock
+    const float quad[] = {-1.f, -1.f, 1.f, -1.f, -1.f, 1.f, 1.f, 1.f};
+    unsigned int quadVAO, quadVBO, densityTexture;
+    glGenVertexArrays(1, &quadVAO);
+    glGenBuffers(1, &quadVBO);
+    glBindVertexArray(quadVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2*sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    glGenTextures(1, &densityTexture);
+    glBindTexture(GL_TEXTURE_2D, densityTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    int density_scale_location = glGetUniformLocation(splatProgram, "density_scale");
+
+    // Above this many visible boids per pixel triangles are sub-pixel noise
+    const float splat_boids_per_pixel = 0.5f;
+    const int splat_pixels_per_cell = 2;
+    DensitySplat splat;
+    std::vector<const point_bucket*> visible_leaves;
+
+    // Simulation rate, independent of the display. Extra steps are run
+    // back to back when the simulation falls behind, up to max_substeps
+    const double steps_per_second = 60.0;
+    const size_t max_substeps = 4;
+
+    // Simulation runs on its own thread and publishes every batch of steps
+    // into a triple buffer, the render loop below draws the newest one
+    TripleBuffer<FrameSnapshot> snapshots;
+    std::atomic<bool> running{true};
+    std::thread simulation([&]()
+    {
+        std::vector<point_bucket> tree;
+        std::vector<std::vector<point_bucket> > tiles;
+        TaskGraph frame;
+        std::vector<float> previous_location[Flock::dimension];
+        FixedTimestep timestep(steps_per_second, max_substeps);
+        size_t step = 0;
+        while(running.load(std::memory_order_relaxed))
+        {
+            size_t substeps = timestep.Wait();
+            auto start = std::chrono::high_resolution_clock::now();
+            for(size_t substep = 0; substep < substeps; substep++, step++)
+            {
+                flock.ShiftTree(step);
+                if(substep + 1 == substeps)
+                    for(size_t d = 0; d < Flock::dimension; d++)
+                        previous_location[d] = flock.location[d];
+                // Tiles are split, updated and integrated leaf by leaf as tasks
+                ScheduleStep(frame, flock, tiles);
+                frame.Run();
+            }
+            tree.clear();
+            for(auto& tile: tiles)
+                std::move(tile.begin(), tile.end(), std::back_inserter(tree));
+
+            FrameSnapshot& snapshot = snapshots.WriteBuffer();
+            snapshot.flock = flock;
+            for(size_t d = 0; d < Flock::dimension; d++)
+                std::swap(snapshot.previous_location[d], previous_location[d]);
+            std::swap(snapshot.tree, tree);
+            snapshot.step = step;
+            snapshot.substeps = substeps;
+            snapshot.step_seconds = timestep.StepSeconds();
+            snapshot.scheduled = timestep.LastStep();
+            snapshot.published = std::chrono::high_resolution_clock::now();
+            snapshot.compute_ms = std::chrono::duration<float, std::milli>(snapshot.published-start).count()/substeps;
+            snapshots.Publish();
+        }
+    });
+
+    size_t frames = 0, new_frames = 0;
+    size_t first_step = 0;
+    float compute_ms_sum = 0, latency_ms_sum = 0;
+    auto report_start = std::chrono::high_resolution_clock::now();
     // render loop
     while(!glfwWindowShouldClose(window))
     {
         processInput(window);
 
-        //Begin CPS timer
-        start = std::chrono::high_resolution_clock::now();
-        //Computation Step
-        std::vector<point_bucket<Boid> > tree;
-        point_bucket<Boid> base(0, 0, 2, 2, flock.boids);
-        base_split(base, 16, tree, 20);
-        for(auto& elm: tree)
+        bool fresh = snapshots.Acquire();
+        const FrameSnapshot& snapshot = snapshots.ReadBuffer();
+        if(fresh)
         {
-            flock.Update(elm.bucket);
+            new_frames++;
+            compute_ms_sum += snapshot.compute_ms;
         }
-        flock.Mirror();
-        CPS_sum+=1000.f/std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now()-start).count();
 
         // rendering commands here
         glClearColor(0.2f, 0.3f, 0.2f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
 
-        glUseProgram(shaderProgram);
+        InterpolatedView view{snapshot, snapshot.Alpha(std::chrono::high_resolution_clock::now())};
 
-        //Begin FPS timer
-        start = std::chrono::high_resolution_clock::now();
+        // Only leaves touching the view are drawn. The tree was built one step
+        // before snapshot.flock, and CapVector caps the squared speed, so a boid
+        // moves up to sqrt(max_velocity_magnitude) out of its leaf. The margin
+        // also covers the triangle drawn around it, 4 pixels long.
+        float cull_margin = sqrtf(snapshot.flock.Parameters().max_velocity_magnitude) + 8.f/(std::min(camera.width, camera.height)*camera.zoom);
+        CullLeaves(snapshot.flock, snapshot.tree, camera, cull_margin, visible_leaves);
+        size_t visible_estimate = 0;
+        for(const point_bucket* leaf: visible_leaves)
+            visible_estimate += leaf->bucket.size();
 
-        glBindVertexArray(VAO);
-        updateVertices(flock.boids, window, vertices);
-        updateBuffer(VBO, 0, vertices.data(), sizeof(vertices[0])*static_cast<uint>(vertices.size()), GL_ARRAY_BUFFER);
-        size_t draw_running_total = vertices.size()/3;
-        GLint draw_offset = 0;
-        while(draw_running_total > 0)
+        if(visible_estimate > splat_boids_per_pixel*camera.width*camera.height)
+        {
+            splat.Resize(camera.width, camera.height, splat_pixels_per_cell);
+            splat.Bin(view, visible_leaves, camera);
+
+            glUseProgram(splatProgram);
+            glUniform1f(density_scale_location, 0.5f*splat.width*splat.height/visible_estimate);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, densityTexture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, splat.width, splat.height, 0, GL_RGB, GL_FLOAT, splat.grid.data());
+            glBindVertexArray(quadVAO);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        }
+        else
         {
-            glDrawArrays(GL_TRIANGLES, draw_offset, draw_running_total > draw_size? draw_size: draw_running_total);
-            draw_running_total -= draw_size;
-            draw_offset += draw_size;
+            glUseProgram(shaderProgram);
+            glUniform3f(view_location, camera.x, camera.y, camera.zoom);
+            glBindVertexArray(VAO);
+            size_t visible_boids = updateVertices(view, visible_leaves, camera, vertices);
+            updateBuffer(VBO, 0, vertices.data(), sizeof(vertices[0])*static_cast<uint>(visible_boids*9), GL_ARRAY_BUFFER);
+            size_t draw_running_total = visible_boids*3;
+            GLint draw_offset = 0;
+            while(draw_running_total > 0)
+            {
+                size_t count = draw_running_total > draw_size? draw_size: draw_running_total;
+                glDrawArrays(GL_TRIANGLES, draw_offset, count);
+                draw_running_total -= count;
+                draw_offset += count;
+            }
         }
 
         // check and call events and swap the buffers
         glfwSwapBuffers(window);
         glfwPollEvents();
 
-        // PULL FPS FOR DRAW
-        FPS_sum+=1000.f/std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now()-start).count();
-        
+        // Latency is from the step being published to its frame being swapped in
+        if(fresh)
+            latency_ms_sum += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now()-snapshot.published).count();
+
         frames++;
         if(frames==100)
         {
-            std::cout << "Average across 100 frames... \n" << FPS_sum/frames << " FPS\n"
-            << CPS_sum/frames << " CPS\n";
-            FPS_sum = 0;
-            CPS_sum = 0;
+            float seconds = std::chrono::duration<float>(std::chrono::high_resolution_clock::now()-report_start).count();
+            std::cout << "Average across 100 frames... \n" << frames/seconds << " FPS\n"
+            << (snapshot.step-first_step)/seconds << " CPS\n";
+            if(new_frames)
+                std::cout << compute_ms_sum/new_frames << " ms per step, "
+                << latency_ms_sum/new_frames << " ms step to screen latency\n";
+            first_step = snapshot.step;
+            compute_ms_sum = 0;
+            latency_ms_sum = 0;
+            new_frames = 0;
             frames = 0;
+            report_start = std::chrono::high_resolution_clock::now();
         }
-
-        //END PULL FOR FPS
-
     }
 
+    running = false;
+    simulation.join();
+
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
     glDeleteProgram(shaderProgram);
+    glDeleteVertexArrays(1, &quadVAO);
+    glDeleteBuffers(1, &quadVBO);
+    glDeleteTextures(1, &densityTexture);
+    glDeleteProgram(splatProgram);
 
     glfwTerminate();
     return 0;
@@ -193,6 +325,33 @@ void processInput(GLFWwindow* window)
 {
     if(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
+
+    // Arrow keys/WASD pan a fraction of the view per frame, R resets
+    Camera& camera = *static_cast<Camera*>(glfwGetWindowUserPointer(window));
+    const float pan_speed = 0.02f;
+    if(glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) camera.Pan(-pan_speed, 0.f);
+    if(glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) camera.Pan(pan_speed, 0.f);
+    if(glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) camera.Pan(0.f, -pan_speed);
+    if(glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) camera.Pan(0.f, pan_speed);
+    if(glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) camera.Reset();
+}
+
+// Scroll zooms about the cursor
+void scroll_callback(GLFWwindow* window, double, double y_offset)
+{
+    Camera& camera = *static_cast<Camera*>(glfwGetWindowUserPointer(window));
+    double cursor_x, cursor_y;
+    glfwGetCursorPos(window, &cursor_x, &cursor_y);
+    float ndc_x = 2.f*static_cast<float>(cursor_x)/camera.width - 1.f;
+    float ndc_y = 1.f - 2.f*static_cast<float>(cursor_y)/camera.height;
+    camera.ZoomAt(powf(1.2f, static_cast<float>(y_offset)), ndc_x, ndc_y);
+}
+
+void window_size_callback(GLFWwindow* window, int width, int height)
+{
+    Camera& camera = *static_cast<Camera*>(glfwGetWindowUserPointer(window));
+    camera.width = width;
+    camera.height = height;
 }
 
 unsigned int init_GL_Shader(std::string filePath, GLenum shaderType)
@@ -252,27 +411,34 @@ void updateBuffer(uint &id, uint offset, void *data, uint size, GLenum shaderTyp
     glBufferSubData(shaderType, offset, size, data);
 }
 
-void updateVertices(std::vector<Boid>& data, GLFWwindow* window, std::vector<float>& vertices)
+size_t updateVertices(const InterpolatedView& flock, const std::vector<const point_bucket*>& leaves, const Camera& camera, std::vector<float>& vertices)
 {
-    int width, height;
-    glfwGetWindowSize(window, &width, &height);
-    for(size_t ind = 0; ind < data.size(); ind++)
+    // Triangles keep the same size on screen at any zoom
+    float scale_x = 1.f/(camera.width*camera.zoom);
+    float scale_y = 1.f/(camera.height*camera.zoom);
+    size_t i = 0;
+    for(const point_bucket* leaf: leaves)
     {
-        size_t i = ind*9;
-        Boid& boid = data[ind];
-        std::vector<float> directionalVector = NormalizeVectorCopy(boid.velocity, 1.f);
-        directionalVector[0]/=width;
-        directionalVector[1]/=height;
-
-        vertices[i+0] = (boid.location[0]-directionalVector[1]);
-        vertices[i+1] = (boid.location[1]+directionalVector[0]);
-
-        vertices[i+3] = (boid.location[0]+directionalVector[1]);
-        vertices[i+4] = (boid.location[1]-directionalVector[0]);
-
-        for(auto& elm: directionalVector)
-            elm*=4;
-        vertices[i+6] = (boid.location[0]+directionalVector[0]);
-        vertices[i+7] = (boid.location[1]+directionalVector[1]);
+        for(size_t ind: leaf->bucket)
+        {
+            float x = flock.GetLocation(0, ind), y = flock.GetLocation(1, ind);
+            float directionalVector[2] = {flock.GetVelocity(0, ind), flock.GetVelocity(1, ind)};
+            NormalizeVectorInPlace(directionalVector, 1.f);
+            directionalVector[0]*=scale_x;
+            directionalVector[1]*=scale_y;
+
+            vertices[i+0] = (x-directionalVector[1]);
+            vertices[i+1] = (y+directionalVector[0]);
+
+            vertices[i+3] = (x+directionalVector[1]);
+            vertices[i+4] = (y-directionalVector[0]);
+
+            for(auto& elm: directionalVector)
+                elm*=4;
+            vertices[i+6] = (x+directionalVector[0]);
+            vertices[i+7] = (y+directionalVector[1]);
+            i += 9;
+        }
     }
-}
\ No newline at end of file
+    return i/9;
+}